@@ -3,43 +3,183 @@
 #include "gb.h"
 #include "ppu.h"
 
+#include <algorithm>
+
+Bus::Bus() : io(counters), joypad(this) {
+  // Sound is not emulated, but every game touches it, so it reads as open
+  // bus without being counted as unconnected.
+  for (uint16_t addr = 0xFF10; addr <= 0xFF3F; addr++)
+    io.connect(
+        addr, this, [](void *bus, uint16_t addr) -> uint8_t { return 0xFF; },
+        [](void *bus, uint16_t addr, uint8_t value) {});
+  io.connect(0xFF46, this, nullptr,
+             [](void *bus, uint16_t addr, uint8_t value) {
+               static_cast<Bus *>(bus)->inDMATransfer = true;
+               static_cast<Bus *>(bus)->DMAAddress = value << 8;
+             });
+}
+
 void Bus::connectCPU(CPU *cpu) { this->cpu = cpu; }
-void Bus::connectPPU(PPU *ppu) { this->ppu = ppu; }
+void Bus::connectPPU(PPU *ppu) {
+  this->ppu = ppu;
+  remap();
+}
+
+void Bus::mapPage(uint8_t page, const uint8_t *read, uint8_t *write) {
+  if (watchpoints.isTrapped(page, WatchRead))
+    read = nullptr;
+  if (watchpoints.isTrapped(page, WatchWrite))
+    write = nullptr;
+  readPages[page] = read;
+  writePages[page] = write;
+}
+
+uint8_t *Bus::mapRomPage(uint8_t page, uint64_t offset) {
+  if (offset + 0x100 > cartridge.size()) {
+    romPages[page] = nullptr;
+    return nullptr;
+  }
+  if (!cheats.patchesPage(page)) {
+    romPages[page] = &cartridge[offset];
+    return romPages[page];
+  }
+
+  romOverlay.resize(0x8000);
+  uint8_t *overlay = &romOverlay[page << 8];
+  std::copy(&cartridge[offset], &cartridge[offset] + 0x100, overlay);
+  cheats.applyToPage(page, overlay);
+  romPages[page] = overlay;
+  return overlay;
+}
+
+void Bus::mapCartridgeBank() {
+  for (int page = 0x40; page < 0x80; page++) {
+    uint64_t offset = cartridgeBankAddress + ((page - 0x40) << 8);
+    mapPage(page, mapRomPage(page, offset), nullptr);
+  }
+}
+
+void Bus::remap() {
+  for (int page = 0; page < 0x100; page++)
+    mapPage(page, nullptr, nullptr);
+
+  for (int page = 0x00; page < 0x40; page++)
+    mapPage(page, mapRomPage(page, page << 8), nullptr);
+  mapCartridgeBank();
+  if (ppu) {
+    for (int page = 0x80; page < 0xA0; page++) {
+      mapPage(page, ppu->getVRam() + ((page - 0x80) << 8), nullptr);
+    }
+  }
+  if (ram.size() >= 0x2000) {
+    for (int page = 0xA0; page < 0xC0; page++) {
+      uint8_t *memory = &ram[(page - 0xA0) << 8];
+      mapPage(page, memory, memory);
+    }
+  }
+  if (ramBank.size() >= 0x2000) {
+    for (int page = 0xC0; page < 0xFE; page++) {
+      uint8_t *memory = &ramBank[((page - 0xC0) << 8) & 0x1FFF];
+      mapPage(page, memory, memory);
+    }
+  }
+}
+
+void Bus::saveState(State &state) const {
+  state.ram = ram;
+  state.ramBank = ramBank;
+  state.cartridgeBankAddress = cartridgeBankAddress;
+  state.ramBankAddress = ramBankAddress;
+  state.DMAAddress = DMAAddress;
+  state.inDMATransfer = inDMATransfer;
+  io.saveState(state.io);
+  joypad.saveState(state.joypad);
+}
+
+void Bus::loadState(const State &state) {
+  // Assigning vectors of the same size keeps their memory, so the pages
+  // mapped into them stay valid.
+  ram = state.ram;
+  ramBank = state.ramBank;
+  ramBankAddress = state.ramBankAddress;
+  DMAAddress = state.DMAAddress;
+  inDMATransfer = state.inDMATransfer;
+  io.loadState(state.io);
+  joypad.loadState(state.joypad);
+  if (cartridgeBankAddress != state.cartridgeBankAddress) {
+    cartridgeBankAddress = state.cartridgeBankAddress;
+    mapCartridgeBank();
+  }
+}
+
+void Bus::onVBlank() {
+  // Straight into memory, through the bus an OAM DMA would take the writes
+  // and watchpoints would blame them on the game.
+  for (const Cheats::GameShark &write : cheats.ramWrites()) {
+    if (write.addr >= 0xFF80) {
+      cpu->writeZeropage(write.addr, write.value);
+    } else if (write.addr >= 0xC000) {
+      size_t offset = write.addr - 0xC000;
+      if (offset < ramBank.size())
+        ramBank[offset] = write.value;
+    } else {
+      size_t offset = write.addr - 0xA000;
+      if (offset < ram.size())
+        ram[offset] = write.value;
+    }
+  }
+}
+
+void Bus::hitWatchpoint(uint16_t addr, WatchKind kind, uint8_t value) {
+  if (watchpoints.check(addr, kind, value, cpu->getRegisters().pc))
+    cpu->triggerBreakpoint();
+}
+
+std::string Bus::getTitle() {
+  std::string title;
+  for (uint16_t addr = 0x0134; addr < 0x0144 && addr < cartridge.size();
+       addr++) {
+    if (cartridge[addr] < 0x20 || cartridge[addr] >= 0x7F)
+      break;
+    title += cartridge[addr];
+  }
+  return title;
+}
 
 void Bus::loadCartridge(std::vector<uint8_t> cartridge) {
   this->cartridge = cartridge;
   this->ramBank.resize(0x2000);
   switch (cartridge[0x0147]) {
   case 0: {
-    printf("Rom only\n");
+    fprintf(stderr, "Rom only\n");
     break;
   }
   case 0x1: {
-    printf("MBC1\n");
+    fprintf(stderr, "MBC1\n");
     break;
   }
   case 0x2: {
-    printf("MBC1+RAM\n");
+    fprintf(stderr, "MBC1+RAM\n");
     break;
   }
   case 0x3: {
-    printf("MBC1+RAM+BATTERY\n");
+    fprintf(stderr, "MBC1+RAM+BATTERY\n");
     break;
   }
   case 0x5: {
-    printf("MBC2\n");
+    fprintf(stderr, "MBC2\n");
     break;
   }
   case 0x6: {
-    printf("MBC2+BATTERY\n");
+    fprintf(stderr, "MBC2+BATTERY\n");
     break;
   }
   case 0x7: {
-    printf("ROM+RAM\n");
+    fprintf(stderr, "ROM+RAM\n");
     break;
   }
   default: {
-    printf("Unknown\n");
+    fprintf(stderr, "Unknown\n");
     break;
   }
   }
@@ -49,26 +189,27 @@ void Bus::loadCartridge(std::vector<uint8_t> cartridge) {
     break;
   }
   case 1: {
-    printf("Ram size: 0x800\n");
+    fprintf(stderr, "Ram size: 0x800\n");
     this->ram.resize(0x800);
     break;
   }
   case 2: {
-    printf("Ram size: 0x2000\n");
+    fprintf(stderr, "Ram size: 0x2000\n");
     this->ram.resize(0x2000);
     break;
   }
   case 3: {
-    printf("Ram size: 0x4000\n");
+    fprintf(stderr, "Ram size: 0x4000\n");
     this->ram.resize(0x4000);
     break;
   }
   default: {
-    printf("Ram size: Unsupported\n");
+    fprintf(stderr, "Ram size: Unsupported\n");
     break;
   }
   }
   this->ram.resize(0x2000);
+  remap();
 }
 
 void Bus::raiseInterrupt(int interrupt) { cpu->raiseInterrupt(interrupt); }
@@ -87,15 +228,10 @@ void Bus::syncronize() {
   }
 }
 
-uint8_t Bus::read(uint16_t addr) {
-  if (inDMATransfer)
-    return read_internal(0xFE00 + (DMAAddress & 0xFF));
-
-  return read_internal(addr);
-}
-
 uint8_t Bus::read_internal(uint16_t addr) {
-  if (addr < 0x4000) {
+  if (addr < 0x8000 && romPages[addr >> 8]) {
+    return romPages[addr >> 8][addr & 0xFF];
+  } else if (addr < 0x4000) {
     return cartridge[addr];
   } else if (addr < 0x8000) {
     return cartridge[cartridgeBankAddress + addr - 0x4000];
@@ -111,29 +247,14 @@ uint8_t Bus::read_internal(uint16_t addr) {
     return ramBank[addr - 0xE000];
   } else if (addr >= 0xFE00 && addr < 0xFEA0) {
     return ppu->read(addr);
-  } else if (addr >= 0xFF00 && addr < 0xFF4C) {
-    if (addr == 0xFF00)
-      return ppu->read(addr);
-    if (addr >= 0xFF10 && addr <= 0xFF3F)
-      return 0xFF; // sound
-    if (addr >= 0xFF40 && addr <= 0xFF4B)
-      return ppu->read(addr);
-
-    fprintf(stderr, "READ TO UNCONNECTED IO at %04X\n", addr);
-    return 0xFF;
+  } else if (addr >= 0xFF00 && addr < 0xFF80) {
+    return io.read(addr);
   }
 
-  fprintf(stderr, "Bus read at bad address: %04X\n", addr);
+  counters.count(AccessClass::UnmappedRead, addr);
   return 0xFF;
 }
 
-void Bus::write(uint16_t addr, uint8_t value) {
-  if (inDMATransfer)
-    write_internal(0xFE00 + (DMAAddress & 0xFF), value);
-  else
-    write_internal(addr, value);
-}
-
 void Bus::write_internal(uint16_t addr, uint8_t value) {
   if (addr < 0x8000) {
     if (addr < 0x2000)
@@ -141,15 +262,13 @@ void Bus::write_internal(uint16_t addr, uint8_t value) {
     if (cartridge[0x147] >= 1 && cartridge[0x147] <= 3) {
       if (addr >= 0x2000 && addr < 0x4000) {
         cartridgeBankAddress = std::max(0x4000 * (value & 0x1F), 0x4000);
+        mapCartridgeBank();
       } else if (addr >= 0x6000 && addr < 0x8000) {
-        if (value & 1)
-          printf("Set MBC1 to 4/32\n");
-        else
-          printf("Set MBC1 to 16/8\n");
+        counters.count(AccessClass::MBCModeSelect, addr);
       } else
-        fprintf(stderr, "Wrote %02X to cartridge rom %04X!\n", value, addr);
+        counters.count(AccessClass::RomWrite, addr);
     } else
-      fprintf(stderr, "Wrote %02X to cartridge rom %04X!\n", value, addr);
+      counters.count(AccessClass::RomWrite, addr);
   } else if (addr >= 0x8000 && addr < 0xA000) {
     ppu->write(addr, value);
   } else if (addr >= 0xA000 && addr < 0xC000) {
@@ -162,18 +281,8 @@ void Bus::write_internal(uint16_t addr, uint8_t value) {
     ramBank[addr - 0xE000] = value;
   } else if (addr >= 0xFE00 && addr < 0xFEA0) {
     ppu->write(addr, value);
-  } else if (addr >= 0xFF00 && addr < 0xFF4C) {
-    if (addr == 0xFF00) {
-      ppu->write(addr, value);
-    } else if (addr >= 0xFF10 && addr <= 0xFF3F) {
-      return; // sound
-    } else if (addr == 0xFF46) {
-      inDMATransfer = true;
-      DMAAddress = value << 8;
-    } else if (addr >= 0xFF40 && addr <= 0xFF4B)
-      ppu->write(addr, value);
-    else
-      fprintf(stderr, "WRITE TO UNCONNECTED IO at %04X\n", addr);
+  } else if (addr >= 0xFF00 && addr < 0xFF80) {
+    io.write(addr, value);
   } else
-    fprintf(stderr, "Bus written to at bad address: %04X\n", addr);
+    counters.count(AccessClass::UnmappedWrite, addr);
 }
@@ -1,12 +1,33 @@
 #pragma once
 
+#include "cheats.h"
+#include "io.h"
+#include "joypad.h"
+#include "watch.h"
+
 #include <cstdint>
+#include <string>
 #include <vector>
 
 class CPU;
 class PPU;
 
 class Bus {
+public:
+  // Memory and registers the bus owns, the cartridge, cheats and watchpoints
+  // are configuration and not part of it.
+  struct State {
+    std::vector<uint8_t> ram;
+    std::vector<uint8_t> ramBank;
+    uint64_t cartridgeBankAddress;
+    uint64_t ramBankAddress;
+    uint16_t DMAAddress;
+    bool inDMATransfer;
+    uint8_t io[IO_SIZE];
+    Joypad::State joypad;
+  };
+
+private:
   std::vector<uint8_t> cartridge;
   std::vector<uint8_t> ram;
   std::vector<uint8_t> ramBank;
@@ -14,24 +35,103 @@ class Bus {
   uint64_t cartridgeBankAddress = 0x4000;
   uint64_t ramBankAddress = 0x0000;
 
-  PPU *ppu;
-  CPU *cpu;
+  PPU *ppu = nullptr;
+  CPU *cpu = nullptr;
 
   uint16_t DMAAddress = 0;
   bool inDMATransfer = false;
 
+  AccessCounters counters;
+  IORegisters io;
+  Joypad joypad;
+  Watchpoints watchpoints;
+
+  // Memory map with one entry per 256 byte page. Pages backed by plain memory
+  // point straight at it, everything else (banking registers, OAM, I/O and
+  // pages with watchpoints) is nullptr and goes through read_internal and
+  // write_internal.
+  const uint8_t *readPages[0x100] = {};
+  uint8_t *writePages[0x100] = {};
+
+  // What is currently visible at each ROM page: the cartridge itself, or a
+  // copy of it with the Game Genie patches for that page applied.
+  uint8_t *romPages[0x80] = {};
+  std::vector<uint8_t> romOverlay;
+  Cheats cheats;
+
+  uint8_t *mapRomPage(uint8_t page, uint64_t offset);
+  void mapPage(uint8_t page, const uint8_t *read, uint8_t *write);
+  void mapCartridgeBank();
+  void remap();
+
   uint8_t read_internal(uint16_t addr);
   void write_internal(uint16_t addr, uint8_t value);
+  void hitWatchpoint(uint16_t addr, WatchKind kind, uint8_t value);
 
 public:
+  Bus();
+
   void connectCPU(CPU *cpu);
   void connectPPU(PPU *ppu);
 
+  IORegisters &getIO() { return io; }
+  AccessCounters &getCounters() { return counters; }
+  Joypad &getJoypad() { return joypad; }
+
+  Watchpoints &getWatchpoints() { return watchpoints; }
+  // Must be called after changing the watchpoints so that watched pages are
+  // trapped in the memory map.
+  void updateWatchpoints() { remap(); }
+  void checkWatchpoint(uint16_t addr, WatchKind kind, uint8_t value) {
+    if (watchpoints.isTrapped(addr >> 8, kind))
+      hitWatchpoint(addr, kind, value);
+  }
+
+  Cheats &getCheats() { return cheats; }
+  // Must be called after changing the cheats to rebuild the patched pages.
+  void updateCheats() { remap(); }
+
+  // Copies the state in memory, reusing what state already holds.
+  void saveState(State &state) const;
+  void loadState(const State &state);
+
+  // Called by the PPU when it enters VBlank.
+  void onVBlank();
+
   void loadCartridge(std::vector<uint8_t> boot);
+  // Title from the cartridge header, without the padding.
+  std::string getTitle();
 
   void raiseInterrupt(int interrupt);
 
   void syncronize();
-  uint8_t read(uint16_t addr);
-  void write(uint16_t addr, uint8_t value);
+
+  uint8_t read(uint16_t addr) {
+    if (inDMATransfer)
+      return read_internal(0xFE00 + (DMAAddress & 0xFF));
+
+    const uint8_t *page = readPages[addr >> 8];
+    if (page)
+      return page[addr & 0xFF];
+
+    uint8_t value = read_internal(addr);
+    checkWatchpoint(addr, WatchRead, value);
+    return value;
+  }
+
+  void write(uint16_t addr, uint8_t value) {
+    if (inDMATransfer) {
+      write_internal(0xFE00 + (DMAAddress & 0xFF), value);
+      return;
+    }
+
+    uint8_t *page = writePages[addr >> 8];
+    if (page) {
+      page[addr & 0xFF] = value;
+      return;
+    }
+
+    checkWatchpoint(addr, WatchWrite, value);
+    write_internal(addr, value);
+  }
 };
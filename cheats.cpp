@@ -0,0 +1,103 @@
+#include "cheats.h"
+
+#include <cctype>
+
+static int hexDigit(char c) {
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  c = std::toupper(c);
+  if (c >= 'A' && c <= 'F')
+    return c - 'A' + 10;
+  return -1;
+}
+
+bool Cheats::add(const std::string &code) {
+  if (code.find('-') != std::string::npos)
+    return addGameGenie(code);
+  return addGameShark(code);
+}
+
+bool Cheats::addGameGenie(const std::string &code) {
+  // ABC-DEF-GHI: AB is the new value, FCDE the address with F inverted and
+  // GI the compare value, rotated left by two and xored with 0xBA. H is not
+  // used by the hardware.
+  if (code.size() != 7 && code.size() != 11)
+    return false;
+
+  int digits[11];
+  for (size_t i = 0; i < code.size(); i++) {
+    if (i == 3 || i == 7) {
+      if (code[i] != '-')
+        return false;
+      continue;
+    }
+    digits[i] = hexDigit(code[i]);
+    if (digits[i] < 0)
+      return false;
+  }
+
+  GameGenie patch;
+  patch.value = (digits[0] << 4) | digits[1];
+  patch.addr = ((digits[6] ^ 0xF) << 12) | (digits[2] << 8) |
+               (digits[4] << 4) | digits[5];
+  patch.hasCompare = code.size() == 11;
+  patch.compare = 0;
+  if (patch.hasCompare) {
+    uint8_t compare = (digits[8] << 4) | digits[10];
+    compare = (compare >> 2) | (compare << 6);
+    patch.compare = compare ^ 0xBA;
+  }
+
+  if (patch.addr >= 0x8000)
+    return false;
+
+  patches.push_back(patch);
+  patchedPages[patch.addr >> 8] = true;
+  return true;
+}
+
+bool Cheats::addGameShark(const std::string &code) {
+  // ABCDEFGH: AB is the external RAM bank, CD the value and GHEF the address.
+  if (code.size() != 8)
+    return false;
+
+  int digits[8];
+  for (int i = 0; i < 8; i++) {
+    digits[i] = hexDigit(code[i]);
+    if (digits[i] < 0)
+      return false;
+  }
+
+  GameShark write;
+  write.bank = (digits[0] << 4) | digits[1];
+  write.value = (digits[2] << 4) | digits[3];
+  write.addr = (digits[6] << 12) | (digits[7] << 8) | (digits[4] << 4) |
+               digits[5];
+  // Only memory the game keeps its variables in, writing the hardware
+  // registers every frame is not what a code means.
+  bool isRAM = (write.addr >= 0xA000 && write.addr < 0xE000) ||
+               (write.addr >= 0xFF80 && write.addr < 0xFFFF);
+  if (!isRAM)
+    return false;
+
+  writes.push_back(write);
+  return true;
+}
+
+void Cheats::clear() {
+  patches.clear();
+  writes.clear();
+  for (bool &page : patchedPages)
+    page = false;
+}
+
+void Cheats::applyToPage(uint8_t page, uint8_t *overlay) const {
+  for (const GameGenie &patch : patches) {
+    if (patch.addr >> 8 != page)
+      continue;
+    uint8_t &byte = overlay[patch.addr & 0xFF];
+    if (patch.hasCompare && byte != patch.compare)
+      continue;
+    byte = patch.value;
+  }
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Game Genie ROM patches and GameShark RAM writes.
+//
+// Neither kind is checked on the read path: Game Genie codes are baked into
+// overlay copies of the patched ROM pages when the memory map is built, and
+// GameShark codes are written straight into RAM once per frame.
+class Cheats {
+public:
+  struct GameGenie {
+    uint16_t addr;
+    uint8_t value;
+    bool hasCompare;
+    uint8_t compare;
+  };
+
+  struct GameShark {
+    uint8_t bank;
+    uint8_t value;
+    uint16_t addr;
+  };
+
+private:
+  std::vector<GameGenie> patches;
+  std::vector<GameShark> writes;
+
+  bool patchedPages[0x80] = {};
+
+public:
+  // Accepts "ABC-DEF" or "ABC-DEF-GHI" Game Genie codes and "ABCDEFGH"
+  // GameShark codes. GameShark codes have to write cartridge RAM, WRAM or
+  // HRAM.
+  bool add(const std::string &code);
+  bool addGameGenie(const std::string &code);
+  bool addGameShark(const std::string &code);
+  void clear();
+
+  bool empty() const { return patches.empty() && writes.empty(); }
+
+  bool patchesPage(uint8_t page) const {
+    return page < 0x80 && patchedPages[page];
+  }
+  // Patches a copy of the ROM page that is currently mapped at page.
+  void applyToPage(uint8_t page, uint8_t *overlay) const;
+
+  const std::vector<GameShark> &ramWrites() const { return writes; }
+};
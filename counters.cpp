@@ -0,0 +1,129 @@
+#include "counters.h"
+
+#include <cinttypes>
+
+const char *accessClassName(AccessClass accessClass) {
+  switch (accessClass) {
+  case AccessClass::RomWrite:
+    return "rom_write";
+  case AccessClass::MBCModeSelect:
+    return "mbc_mode_select";
+  case AccessClass::UnmappedRead:
+    return "unmapped_read";
+  case AccessClass::UnmappedWrite:
+    return "unmapped_write";
+  case AccessClass::UnconnectedIORead:
+    return "unconnected_io_read";
+  case AccessClass::UnconnectedIOWrite:
+    return "unconnected_io_write";
+  case AccessClass::BadPPURead:
+    return "bad_ppu_read";
+  case AccessClass::BadPPUWrite:
+    return "bad_ppu_write";
+  default:
+    return "unknown";
+  }
+}
+
+const char *memoryRegionName(MemoryRegion region) {
+  switch (region) {
+  case MemoryRegion::Rom:
+    return "rom";
+  case MemoryRegion::VRam:
+    return "vram";
+  case MemoryRegion::ExternalRam:
+    return "external_ram";
+  case MemoryRegion::WorkRam:
+    return "work_ram";
+  case MemoryRegion::EchoRam:
+    return "echo_ram";
+  case MemoryRegion::OAM:
+    return "oam";
+  case MemoryRegion::IO:
+    return "io";
+  default:
+    return "unknown";
+  }
+}
+
+MemoryRegion memoryRegionOf(uint16_t addr) {
+  if (addr < 0x8000)
+    return MemoryRegion::Rom;
+  if (addr < 0xA000)
+    return MemoryRegion::VRam;
+  if (addr < 0xC000)
+    return MemoryRegion::ExternalRam;
+  if (addr < 0xE000)
+    return MemoryRegion::WorkRam;
+  if (addr < 0xFE00)
+    return MemoryRegion::EchoRam;
+  if (addr < 0xFF00)
+    return MemoryRegion::OAM;
+  return MemoryRegion::IO;
+}
+
+uint64_t AccessCounters::totalForPage(AccessClass accessClass,
+                                      uint8_t page) const {
+  return counts[(int)accessClass][page].load(std::memory_order_relaxed);
+}
+
+uint64_t AccessCounters::total(AccessClass accessClass) const {
+  uint64_t sum = 0;
+  for (int page = 0; page < 0x100; page++)
+    sum += totalForPage(accessClass, page);
+  return sum;
+}
+
+uint64_t AccessCounters::total(AccessClass accessClass,
+                               MemoryRegion region) const {
+  uint64_t sum = 0;
+  for (int page = 0; page < 0x100; page++)
+    if (memoryRegionOf(page << 8) == region)
+      sum += totalForPage(accessClass, page);
+  return sum;
+}
+
+void AccessCounters::report(FILE *out) {
+  auto now = std::chrono::steady_clock::now();
+  if (now - lastReport < reportInterval)
+    return;
+  lastReport = now;
+
+  for (int c = 0; c < (int)AccessClass::Count; c++) {
+    AccessClass accessClass = (AccessClass)c;
+    uint64_t sum = 0;
+    uint64_t busiest = 0;
+    int busiestPage = 0;
+    for (int page = 0; page < 0x100; page++) {
+      uint64_t count = totalForPage(accessClass, page);
+      sum += count;
+      if (count > busiest) {
+        busiest = count;
+        busiestPage = page;
+      }
+    }
+    if (sum == reportedTotals[c])
+      continue;
+
+    fprintf(out,
+            "%s: %" PRIu64 " new, %" PRIu64 " total, mostly %s at %02Xxx\n",
+            accessClassName(accessClass), sum - reportedTotals[c], sum,
+            memoryRegionName(memoryRegionOf(busiestPage << 8)), busiestPage);
+    reportedTotals[c] = sum;
+  }
+}
+
+void AccessCounters::writeMetrics(FILE *out) const {
+  for (int c = 0; c < (int)AccessClass::Count; c++) {
+    for (int r = 0; r < (int)MemoryRegion::Count; r++) {
+      uint64_t count = total((AccessClass)c, (MemoryRegion)r);
+      if (count == 0)
+        continue;
+      fprintf(out,
+              "gb_memory_access_total{class=\"%s\",region=\"%s\"} %" PRIu64
+              "\n",
+              accessClassName((AccessClass)c),
+              memoryRegionName((MemoryRegion)r), count);
+    }
+  }
+}
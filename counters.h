@@ -0,0 +1,77 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+
+// Kinds of suspicious memory accesses that are counted instead of logged.
+enum class AccessClass : uint8_t {
+  RomWrite,
+  MBCModeSelect,
+  UnmappedRead,
+  UnmappedWrite,
+  UnconnectedIORead,
+  UnconnectedIOWrite,
+  BadPPURead,
+  BadPPUWrite,
+  Count
+};
+
+enum class MemoryRegion : uint8_t {
+  Rom,
+  VRam,
+  ExternalRam,
+  WorkRam,
+  EchoRam,
+  OAM,
+  IO,
+  Count
+};
+
+const char *accessClassName(AccessClass accessClass);
+const char *memoryRegionName(MemoryRegion region);
+MemoryRegion memoryRegionOf(uint16_t addr);
+
+// Counts accesses per class and per 256 byte page of the address space.
+//
+// Counting is a single relaxed increment so it can sit on the emulation hot
+// path. Only the emulation thread counts, any other thread may query the
+// totals or print a report.
+class AccessCounters {
+  std::atomic<uint64_t> counts[(int)AccessClass::Count][0x100] = {};
+
+  uint64_t reportedTotals[(int)AccessClass::Count] = {};
+  std::chrono::steady_clock::time_point lastReport;
+  std::chrono::milliseconds reportInterval{1000};
+  // Speculative frames are run again for real later, so their accesses
+  // would be counted twice.
+  bool speculating = false;
+
+public:
+  void count(AccessClass accessClass, uint16_t addr) {
+    if (speculating)
+      return;
+    std::atomic<uint64_t> &counter = counts[(int)accessClass][addr >> 8];
+    counter.store(counter.load(std::memory_order_relaxed) + 1,
+                  std::memory_order_relaxed);
+  }
+
+  uint64_t total(AccessClass accessClass) const;
+  uint64_t total(AccessClass accessClass, MemoryRegion region) const;
+  uint64_t totalForPage(AccessClass accessClass, uint8_t page) const;
+
+  // While set, accesses are not counted, see RunAhead.
+  void setSpeculating(bool speculating) { this->speculating = speculating; }
+
+  void setReportInterval(std::chrono::milliseconds interval) {
+    reportInterval = interval;
+  }
+
+  // Prints one aggregated line per access class that has new counts since
+  // the previous report. Does nothing if called again within the report
+  // interval, so it is safe to call as often as convenient.
+  void report(FILE *out);
+  // Dumps all non-zero totals as "name{labels} value" lines for scraping.
+  void writeMetrics(FILE *out) const;
+};
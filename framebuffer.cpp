@@ -0,0 +1,97 @@
+#include "framebuffer.h"
+
+#include <cstdio>
+#include <cstring>
+
+int bytesPerPixel(PixelFormat format) {
+  switch (format) {
+  case PixelFormat::RGB888:
+    return 3;
+  case PixelFormat::RGBA8888:
+    return 4;
+  case PixelFormat::RGB565:
+    return 2;
+  case PixelFormat::Indexed:
+    return 1;
+  }
+  return 0;
+}
+
+const char *pixelFormatName(PixelFormat format) {
+  switch (format) {
+  case PixelFormat::RGB888:
+    return "rgb888";
+  case PixelFormat::RGBA8888:
+    return "rgba8888";
+  case PixelFormat::RGB565:
+    return "rgb565";
+  case PixelFormat::Indexed:
+    return "indexed";
+  }
+  return "unknown";
+}
+
+bool parsePixelFormat(const std::string &name, PixelFormat &format) {
+  for (PixelFormat candidate : {PixelFormat::RGB888, PixelFormat::RGBA8888,
+                                PixelFormat::RGB565, PixelFormat::Indexed}) {
+    if (name == pixelFormatName(candidate)) {
+      format = candidate;
+      return true;
+    }
+  }
+  return false;
+}
+
+uint32_t packColor(PixelFormat format, uint32_t rgb, uint8_t shade) {
+  uint8_t r = (rgb >> 16) & 0xFF;
+  uint8_t g = (rgb >> 8) & 0xFF;
+  uint8_t b = rgb & 0xFF;
+  switch (format) {
+  case PixelFormat::RGB888:
+    return rgb;
+  case PixelFormat::RGBA8888: {
+    const uint8_t bytes[4] = {r, g, b, 0xFF};
+    uint32_t value;
+    memcpy(&value, bytes, 4);
+    return value;
+  }
+  case PixelFormat::RGB565:
+    return ((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3);
+  case PixelFormat::Indexed:
+    return shade;
+  }
+  return 0;
+}
+
+bool writePPM(const std::string &path, const uint8_t *rgb, int width,
+              int height) {
+  FILE *file = fopen(path.c_str(), "wb");
+  if (!file)
+    return false;
+  fprintf(file, "P6\n%d %d\n255\n", width, height);
+  size_t bytes = 3 * (size_t)width * height;
+  bool written = fwrite(rgb, 1, bytes, file) == bytes;
+  return fclose(file) == 0 && written;
+}
+
+uint64_t hashLine(const uint8_t *shades, int length) {
+  uint64_t hash = 0;
+  int i = 0;
+  for (; i + 8 <= length; i += 8) {
+    uint64_t word;
+    memcpy(&word, shades + i, 8);
+    hash = (hash ^ word) * 0x9E3779B97F4A7C15ull;
+    hash ^= hash >> 29;
+  }
+  for (; i < length; i++)
+    hash = (hash ^ shades[i]) * 0x100000001B3ull;
+  return hash;
+}
+
+void TripleBuffer::resize(size_t pixelBytes, size_t tileBytes) {
+  for (Frame &frame : frames) {
+    frame.pixels.assign(pixelBytes, 0);
+    frame.tiles.assign(tileBytes, 0);
+    frame.sequence = 0;
+  }
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "latency.h"
+#include "tilecache.h"
+
+// Layouts the PPU can write its output in.
+enum class PixelFormat : uint8_t {
+  RGB888,   // 3 bytes per pixel, R G B
+  RGBA8888, // 4 bytes per pixel, R G B A
+  RGB565,   // 16 bit native endian words, red in the high bits
+  Indexed,  // 1 byte per pixel holding the DMG shade, 0 (light) to 3 (dark)
+};
+
+int bytesPerPixel(PixelFormat format);
+const char *pixelFormatName(PixelFormat format);
+bool parsePixelFormat(const std::string &name, PixelFormat &format);
+
+// Converts a 0xRRGGBB color (or a shade for PixelFormat::Indexed) into the
+// value stored for one pixel.
+uint32_t packColor(PixelFormat format, uint32_t rgb, uint8_t shade);
+
+// Writes RGB888 pixels as a binary PPM image.
+bool writePPM(const std::string &path, const uint8_t *rgb, int width,
+              int height);
+
+// Hashes a line of shades, used to find the lines that changed between
+// frames.
+uint64_t hashLine(const uint8_t *shades, int length);
+
+struct Frame {
+  std::vector<uint8_t> pixels;
+  // Tile data (0x8000-0x97FF) as it was when the frame was finished, for
+  // the VRAM viewer.
+  std::vector<uint8_t> tiles;
+  uint64_t sequence = 0;
+  uint64_t hash = 0;
+
+  // What changed since the frame published before this one. A consumer that
+  // missed a sequence number has to treat everything as changed.
+  int firstDirtyLine = 0;
+  int lastDirtyLine = -1;
+  uint64_t changedTiles[TILE_COUNT / 64] = {};
+  // The earliest host input the game read in this frame or in frames that
+  // were never presented before it.
+  InputStamp input;
+
+  bool follows(uint64_t previous) const { return sequence == previous + 1; }
+  bool tileChanged(int tile) const {
+    return changedTiles[tile / 64] & (1ull << (tile % 64));
+  }
+};
+
+// Hands finished frames from the emulation thread to the presenting thread
+// without locks or copies.
+//
+// The producer always owns one frame to draw into and the consumer always
+// owns one to read from. The third one is shared and swapped with either
+// side through a single atomic, which also records whether it holds a frame
+// the consumer has not seen yet.
+class TripleBuffer {
+public:
+  using PublishHandler = void (*)(void *context);
+
+private:
+  static constexpr uint8_t fresh = 1 << 2;
+
+  Frame frames[3];
+  std::atomic<uint8_t> shared{1};
+  uint8_t back = 0;
+  uint8_t front = 2;
+
+  PublishHandler publishHandler = nullptr;
+  void *publishContext = nullptr;
+
+public:
+  void resize(size_t pixelBytes, size_t tileBytes);
+
+  // Called on the producer's thread after every publish, so a consumer can
+  // sleep until there is something new. Has to be set before the producer
+  // starts.
+  void setPublishHandler(void *context, PublishHandler handler) {
+    publishContext = context;
+    publishHandler = handler;
+  }
+
+  // Producer side. publish() returns true if the frame it replaced was never
+  // acquired, that frame is then the new back buffer.
+  Frame &backBuffer() { return frames[back]; }
+  bool publish() {
+    uint8_t replaced = shared.exchange(back | fresh, std::memory_order_acq_rel);
+    back = replaced & 0x3;
+    if (publishHandler)
+      publishHandler(publishContext);
+    return replaced & fresh;
+  }
+
+  // Consumer side. Returns false and keeps the current front buffer if
+  // nothing new was published since the last call.
+  bool acquire() {
+    if (!(shared.load(std::memory_order_relaxed) & fresh))
+      return false;
+    front = shared.exchange(front, std::memory_order_acq_rel) & 0x3;
+    return true;
+  }
+  const Frame &frontBuffer() const { return frames[front]; }
+};
@@ -3,6 +3,12 @@
 #include "ppu.h"
 
 #include "instructions.h"
+#include "pacer.h"
+#include "recorder.h"
+#include "runahead.h"
+#include "scaler.h"
+#include "selftest.h"
+#include "simd.h"
 #include "utils.h"
 #include <chrono>
 #include <iostream>
@@ -23,16 +29,11 @@ constexpr uint16_t interruptInputAddress = 0x0060;
 constexpr uint32_t timerLUT[] = {7, 1, 3, 5}; // In m cycles
 
 constexpr bool logRegisters = false;
-constexpr bool skipBootScreen = false;
 
 CPU::CPU(Bus *bus)
     : boot(0x100), ram(0x2000), zeropage(0xFFFE - 0xFF80), bus(bus) {
   registers.pc = 0;
   unlockedBootRom = false;
-  if (skipBootScreen) {
-    registers.pc = 0x100;
-    unlockedBootRom = true;
-  }
 
   clockCycle = 0;
   TAC = 0;
@@ -50,6 +51,61 @@ CPU::CPU(Bus *bus)
     registers.l = 0;
     registers.sp = 0;
   }
+
+  connectIO(bus->getIO());
+}
+
+void CPU::connectIO(IORegisters &io) {
+  // Serial is not connected to anything, but games expect the data they
+  // write to read back.
+  io.connectStorage(0xFF01);
+  io.connectStorage(0xFF02);
+
+  io.connect(
+      0xFF04, this,
+      [](void *cpu, uint16_t addr) -> uint8_t {
+        return static_cast<CPU *>(cpu)->clockCycle >> 6;
+      },
+      [](void *cpu, uint16_t addr, uint8_t value) {
+        static_cast<CPU *>(cpu)->clockCycle = 0;
+      });
+  io.connect(
+      0xFF05, this,
+      [](void *cpu, uint16_t addr) -> uint8_t {
+        return static_cast<CPU *>(cpu)->TIMA;
+      },
+      [](void *cpu, uint16_t addr, uint8_t value) {
+        static_cast<CPU *>(cpu)->TIMA = value;
+        static_cast<CPU *>(cpu)->timerHasOverflowed = false;
+      });
+  io.connect(
+      0xFF06, this,
+      [](void *cpu, uint16_t addr) -> uint8_t {
+        return static_cast<CPU *>(cpu)->TMA;
+      },
+      [](void *cpu, uint16_t addr, uint8_t value) {
+        static_cast<CPU *>(cpu)->TMA = value;
+      });
+  io.connect(
+      0xFF07, this,
+      [](void *cpu, uint16_t addr) -> uint8_t {
+        return static_cast<CPU *>(cpu)->TAC;
+      },
+      [](void *cpu, uint16_t addr, uint8_t value) {
+        static_cast<CPU *>(cpu)->TAC = value;
+      });
+  io.connect(
+      0xFF0F, this,
+      [](void *cpu, uint16_t addr) -> uint8_t {
+        return static_cast<CPU *>(cpu)->IF;
+      },
+      [](void *cpu, uint16_t addr, uint8_t value) {
+        static_cast<CPU *>(cpu)->IF = value;
+      });
+  io.connect(0xFF50, this, nullptr, [](void *cpu, uint16_t addr, uint8_t value) {
+    if (value == 0x01)
+      static_cast<CPU *>(cpu)->unlockedBootRom = true;
+  });
 }
 
 bool CPU::step() {
@@ -127,6 +183,7 @@ bool CPU::step() {
              read(registers.pc + 3), TIMA);
     }
 
+    bus->checkWatchpoint(registers.pc, WatchExecute, opcode);
     instr = instruction::decode(opcode);
   if (hasRecoveredFromHalt)
     registers.pc++;
@@ -151,12 +208,80 @@ bool CPU::step() {
 
   hasRecoveredFromHalt = true;
 
-  // if (registers.pc == 0xC5FA)
-  // breakpoint = true;
-
   return !breakpoint;
 }
 
+void CPU::skipBoot() {
+  // State of a DMG right after the boot ROM has handed over to the cartridge.
+  registers.a = 0x01;
+  registers.f = bus->read(0x014D) == 0 ? 0x80 : 0xB0;
+  registers.bc = 0x0013;
+  registers.de = 0x00D8;
+  registers.hl = 0x014D;
+  registers.sp = 0xFFFE;
+  registers.pc = 0x0100;
+
+  clockCycle = 0xABCC >> 2;
+  previousANDresult = false;
+  timerHasOverflowed = false;
+  TIMA = 0x00;
+  TMA = 0x00;
+  TAC = 0xF8;
+  IF = 0xE1;
+  IE = 0x00;
+  interruptsEnabled = false;
+  interruptChangeStateDelay = -1;
+
+  write(0xFF01, 0x00);
+  write(0xFF02, 0x7E);
+
+  unlockedBootRom = true;
+}
+
+void CPU::saveState(State &state) const {
+  state.ram = ram;
+  state.zeropage = zeropage;
+  state.registers = registers;
+  state.instr = instr ? instr->clone() : nullptr;
+  state.clockCycle = clockCycle;
+  state.previousANDresult = previousANDresult;
+  state.timerHasOverflowed = timerHasOverflowed;
+  state.DIV = DIV;
+  state.TIMA = TIMA;
+  state.TMA = TMA;
+  state.TAC = TAC;
+  state.IF = IF;
+  state.IE = IE;
+  state.interruptsEnabled = interruptsEnabled;
+  state.interruptsShouldBeEnabled = interruptsShouldBeEnabled;
+  state.interruptChangeStateDelay = interruptChangeStateDelay;
+  state.halted = halted;
+  state.hasRecoveredFromHalt = hasRecoveredFromHalt;
+  state.unlockedBootRom = unlockedBootRom;
+}
+
+void CPU::loadState(const State &state) {
+  ram = state.ram;
+  zeropage = state.zeropage;
+  registers = state.registers;
+  instr = state.instr ? state.instr->clone() : nullptr;
+  clockCycle = state.clockCycle;
+  previousANDresult = state.previousANDresult;
+  timerHasOverflowed = state.timerHasOverflowed;
+  DIV = state.DIV;
+  TIMA = state.TIMA;
+  TMA = state.TMA;
+  TAC = state.TAC;
+  IF = state.IF;
+  IE = state.IE;
+  interruptsEnabled = state.interruptsEnabled;
+  interruptsShouldBeEnabled = state.interruptsShouldBeEnabled;
+  interruptChangeStateDelay = state.interruptChangeStateDelay;
+  halted = state.halted;
+  hasRecoveredFromHalt = state.hasRecoveredFromHalt;
+  unlockedBootRom = state.unlockedBootRom;
+}
+
 void CPU::raiseInterrupt(int interrupt) { IF |= interrupt; }
 
 uint8_t CPU::read(uint16_t addr) {
@@ -175,30 +300,19 @@ uint8_t CPU::read(uint16_t addr) {
     return bus->read(addr);
   if (addr >= 0xFE00 && addr < 0xFEA0)
     return bus->read(addr);
-  if (addr >= 0xFF00 && addr < 0xFF4C) {
-    if (addr == 0xFF04)
-      return clockCycle >> 6;
-    if (addr == 0xFF05)
-      return TIMA;
-    if (addr == 0xFF06)
-      return TMA;
-    if (addr == 0xFF07)
-      return TAC;
-    if (addr == 0xFF0F)
-      return IF;
-    if (addr >= 0xFF40 && addr <= 0xFF4B) {
-      return bus->read(addr);
-    }
-
+  if (addr >= 0xFF00 && addr < 0xFF80)
     return bus->read(addr);
-  }
-  if (addr >= 0xFF80 && addr <= 0xFFFE)
+  if (addr >= 0xFF80 && addr <= 0xFFFE) {
+    bus->checkWatchpoint(addr, WatchRead, zeropage[addr - 0xFF80]);
     return zeropage[addr - 0xFF80];
-  if (addr == 0xFFFF)
+  }
+  if (addr == 0xFFFF) {
+    bus->checkWatchpoint(addr, WatchRead, IE);
     return IE;
+  }
 
   breakpoint = true;
-  printf("ERROR: READ MEMORY OUT OF BOUNDS : %04X\n", addr);
+  fprintf(stderr, "ERROR: READ MEMORY OUT OF BOUNDS : %04X\n", addr);
   return 0xFF;
 }
 
@@ -215,39 +329,19 @@ void CPU::write(uint16_t addr, uint8_t value) {
     bus->write(addr, value);
   else if (addr >= 0xFE00 && addr < 0xFEA0)
     bus->write(addr, value);
-  else if (addr >= 0xFF00 && addr < 0xFF4C) {
-    if (addr == 0xFF01) {
-      // serial
-      // fprintf(stderr, "%c", value);
-    } else if (addr == 0xFF02) {
-    } else if (addr == 0xFF04) {
-      clockCycle = 0;
-    } else if (addr == 0xFF05) {
-      TIMA = value;
-      timerHasOverflowed = false;
-      // printf("Wrote %02X to TIMA\n", value);
-    } else if (addr == 0xFF06) {
-      TMA = value;
-      // printf("Wrote %02X to TMA\n", TMA);
-    } else if (addr == 0xFF07) {
-      TAC = value;
-      // printf("Wrote %02X to TAC\n", TAC);
-    } else if (addr == 0xFF0F) {
-      IF = value;
-    } else {
-      bus->write(addr, value);
-    }
-  } else if (addr == 0xFF50 && value == 0x01) {
-    unlockedBootRom = true;
-  } else if (addr >= 0xFF80 && addr <= 0xFFFE) {
+  else if (addr >= 0xFF00 && addr < 0xFF80)
+    bus->write(addr, value);
+  else if (addr >= 0xFF80 && addr <= 0xFFFE) {
+    bus->checkWatchpoint(addr, WatchWrite, value);
     zeropage[addr - 0xFF80] = value;
   } else if (addr == 0xFFFF) {
+    bus->checkWatchpoint(addr, WatchWrite, value);
     // printf("Wrote %02X to IE\n", value);
     // util::printfBits("IE bits: ", value, 8);
     IE = value;
   } else {
     breakpoint = true;
-    printf("ERROR: WRITE MEMORY OUT OF BOUNDS at %04X\n", addr);
+    fprintf(stderr, "ERROR: WRITE MEMORY OUT OF BOUNDS at %04X\n", addr);
   }
 }
 
@@ -260,31 +354,32 @@ void CPU::dumpBoot() { util::hexdump(boot, boot.size()); }
 void CPU::dumpRam() { util::hexdump(ram, ram.size(), 0xC000); }
 
 void CPU::dumpRegisters() {
-  printf("        == Registers ===\n");
-  printf("================");
-  printf("================\n");
-  printf("===    PC    ===");
-  printf("===    SP    ===\n");
-  printf("===   %04X   ===", registers.pc);
-  printf("===   %04X   ===\n", registers.sp);
-  printf("================");
-  printf("================\n");
-  printf("==  A  == F   ==");
-  printf("==  B  == C   ==\n");
-  printf("==  %02X == %02X  ==", registers.a, registers.f);
-  printf("==  %02X == %02X  ==\n", registers.b, registers.c);
-  printf("================");
-  printf("================\n");
-  printf("==  D  == E   ==");
-  printf("==  H  == L   ==\n");
-  printf("==  %02X == %02X  ==", registers.d, registers.e);
-  printf("==  %02X == %02X  ==\n", registers.h, registers.l);
-  printf("================");
-  printf("================\n");
-  printf("===   ZNHC   ===\n");
-  printf("===   %i%i%i%i   ===\n", registers.f >> 7, (registers.f >> 6) & 1,
-         (registers.f >> 5) & 1, (registers.f >> 4) & 1);
-  printf("================\n");
+  fprintf(stderr, "        == Registers ===\n");
+  fprintf(stderr, "================");
+  fprintf(stderr, "================\n");
+  fprintf(stderr, "===    PC    ===");
+  fprintf(stderr, "===    SP    ===\n");
+  fprintf(stderr, "===   %04X   ===", registers.pc);
+  fprintf(stderr, "===   %04X   ===\n", registers.sp);
+  fprintf(stderr, "================");
+  fprintf(stderr, "================\n");
+  fprintf(stderr, "==  A  == F   ==");
+  fprintf(stderr, "==  B  == C   ==\n");
+  fprintf(stderr, "==  %02X == %02X  ==", registers.a, registers.f);
+  fprintf(stderr, "==  %02X == %02X  ==\n", registers.b, registers.c);
+  fprintf(stderr, "================");
+  fprintf(stderr, "================\n");
+  fprintf(stderr, "==  D  == E   ==");
+  fprintf(stderr, "==  H  == L   ==\n");
+  fprintf(stderr, "==  %02X == %02X  ==", registers.d, registers.e);
+  fprintf(stderr, "==  %02X == %02X  ==\n", registers.h, registers.l);
+  fprintf(stderr, "================");
+  fprintf(stderr, "================\n");
+  fprintf(stderr, "===   ZNHC   ===\n");
+  fprintf(stderr, "===   %i%i%i%i   ===\n", registers.f >> 7,
+          (registers.f >> 6) & 1, (registers.f >> 5) & 1,
+          (registers.f >> 4) & 1);
+  fprintf(stderr, "================\n");
 }
 
 void startRenderLoop(PPU *ppu) {
@@ -294,6 +389,40 @@ void startRenderLoop(PPU *ppu) {
   ppu->cleanup();
 }
 
+void printFrameHash(void *, const FrameHash &hash) {
+  printf("frame %llu %016llx\n", (unsigned long long)hash.frame,
+         (unsigned long long)hash.hash);
+  if (hash.lines)
+    for (int y = 0; y < HEIGHT; y++)
+      printf("frame %llu line %d %016llx\n", (unsigned long long)hash.frame, y,
+             (unsigned long long)hash.lines[y]);
+}
+
+// Replaces path with the current metrics. They are written next to it and
+// renamed, so a scraper never reads half a file.
+bool writeMetricsFile(const std::string &path, Bus &bus, PPU &ppu) {
+  std::string temporary = path + ".tmp";
+  FILE *out = fopen(temporary.c_str(), "w");
+  if (!out)
+    return false;
+  bus.getCounters().writeMetrics(out);
+  ppu.getInputLatency().writeMetrics(out);
+  bool written = fclose(out) == 0;
+  return written && rename(temporary.c_str(), path.c_str()) == 0;
+}
+
+// Scales the last finished frame and writes it as a PPM image.
+bool saveScreenshot(PPU &ppu, Scaler &scaler, const std::string &path) {
+  TripleBuffer &frames = ppu.getFrames();
+  frames.acquire();
+  const Frame &frame = frames.frontBuffer();
+  int factor = scaler.getFactor();
+  std::vector<uint8_t> rgb(3 * WIDTH * HEIGHT * factor * factor);
+  scaler.scale(frame.pixels.data(), WIDTH, HEIGHT, ppu.getPixelFormat(),
+               dmgPalettes[ppu.getPalette()].colors, rgb.data());
+  return writePPM(path, rgb.data(), WIDTH * factor, HEIGHT * factor);
+}
+
 int main(int argc, char **argv) {
   Bus bus;
   CPU cpu(&bus);
@@ -301,24 +430,245 @@ int main(int argc, char **argv) {
   bus.connectCPU(&cpu);
   bus.connectPPU(&ppu);
 
-  if (argc == 2) {
-    bus.loadCartridge(util::readFile(argv[1]));
-    printf("Loaded Cartride!\n");
+  std::string romPath;
+  bool fastBoot = false;
+  bool renderThread = false;
+  bool engineGiven = false;
+  bool headless = false;
+  int frameLimit = 0;
+  std::string screenshotPath;
+  ScaleFilter scaleFilter = ScaleFilter::Nearest;
+  int scaleFactor = 1;
+  std::string recordTarget;
+  VideoContainer recordContainer = VideoContainer::Y4M;
+  QueuePolicy recordPolicy = QueuePolicy::Drop;
+  int recordQueue = 8;
+  bool printFrameHashes = false;
+  bool printLineHashes = false;
+  std::string inputLogPath;
+  std::string inputReplayPath;
+  std::string metricsPath;
+  bool selfTest = false;
+  int runAheadFrames = 0;
+  bool watching = false;
+  FrameSkipper frameSkipper;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--watch" && i + 1 < argc) {
+      if (!bus.getWatchpoints().addFromSpec(argv[++i])) {
+        fprintf(stderr, "Invalid watchpoint '%s', expected e.g. rw:C0A0 or "
+                        "x:0150:break\n",
+                argv[i]);
+        return 1;
+      }
+      watching = true;
+    } else if (arg == "--simd" && i + 1 < argc) {
+      if (!simd::setImplementation(argv[++i])) {
+        fprintf(stderr, "Unsupported SIMD implementation '%s'\n", argv[i]);
+        return 1;
+      }
+    } else if (arg == "--palette" && i + 1 < argc) {
+      if (!ppu.setPalette(argv[++i])) {
+        fprintf(stderr, "Unknown palette '%s', available:", argv[i]);
+        for (int p = 0; p < dmgPaletteCount; p++)
+          fprintf(stderr, " %s", dmgPalettes[p].name);
+        fprintf(stderr, "\n");
+        return 1;
+      }
+    } else if (arg == "--pixel-format" && i + 1 < argc) {
+      PixelFormat format;
+      if (!parsePixelFormat(argv[++i], format)) {
+        fprintf(stderr, "Unknown pixel format '%s', available: rgb888 "
+                        "rgba8888 rgb565 indexed\n",
+                argv[i]);
+        return 1;
+      }
+      ppu.setPixelFormat(format);
+    } else if (arg == "--fast-boot") {
+      fastBoot = true;
+    } else if (arg == "--render-thread") {
+      renderThread = true;
+    } else if (arg == "--headless") {
+      headless = true;
+    } else if (arg == "--frames" && i + 1 < argc) {
+      frameLimit = atoi(argv[++i]);
+    } else if (arg == "--screenshot" && i + 1 < argc) {
+      screenshotPath = argv[++i];
+    } else if (arg == "--scale" && i + 1 < argc) {
+      if (!parseScaleFilter(argv[++i], scaleFilter, scaleFactor)) {
+        fprintf(stderr, "Unknown scale filter '%s', available: nearest "
+                        "nearest:N scale2x scale3x xbr\n",
+                argv[i]);
+        return 1;
+      }
+    } else if (arg == "--record" && i + 1 < argc) {
+      recordTarget = argv[++i];
+    } else if (arg == "--record-format" && i + 1 < argc) {
+      if (!parseVideoContainer(argv[++i], recordContainer)) {
+        fprintf(stderr, "Unknown video format '%s', available: y4m raw\n",
+                argv[i]);
+        return 1;
+      }
+    } else if (arg == "--record-queue" && i + 1 < argc) {
+      recordQueue = atoi(argv[++i]);
+    } else if (arg == "--record-when-full" && i + 1 < argc) {
+      if (!parseQueuePolicy(argv[++i], recordPolicy)) {
+        fprintf(stderr, "Unknown queue policy '%s', available: drop block\n",
+                argv[i]);
+        return 1;
+      }
+    } else if (arg == "--print-frame-hashes") {
+      printFrameHashes = true;
+    } else if (arg == "--print-line-hashes") {
+      printFrameHashes = true;
+      printLineHashes = true;
+    } else if (arg == "--log-input" && i + 1 < argc) {
+      inputLogPath = argv[++i];
+    } else if (arg == "--replay-input" && i + 1 < argc) {
+      inputReplayPath = argv[++i];
+    } else if (arg == "--self-test") {
+      selfTest = true;
+    } else if (arg == "--metrics" && i + 1 < argc) {
+      metricsPath = argv[++i];
+    } else if (arg == "--run-ahead" && i + 1 < argc) {
+      runAheadFrames = atoi(argv[++i]);
+      if (runAheadFrames < 0 || runAheadFrames > 4) {
+        fprintf(stderr, "Invalid run-ahead '%s', expected 0-4 frames\n",
+                argv[i]);
+        return 1;
+      }
+    } else if (arg == "--frameskip" && i + 1 < argc) {
+      if (!frameSkipper.parse(argv[++i])) {
+        fprintf(stderr, "Invalid frame skip '%s', expected 0-9 or auto\n",
+                argv[i]);
+        return 1;
+      }
+    } else if (arg == "--ppu" && i + 1 < argc) {
+      PPUEngine engine;
+      if (!parsePPUEngine(argv[++i], engine)) {
+        fprintf(stderr, "Unknown PPU engine '%s', available: scanline fifo\n",
+                argv[i]);
+        return 1;
+      }
+      ppu.setEngine(engine);
+      engineGiven = true;
+    } else if (arg == "--cheat" && i + 1 < argc) {
+      if (!bus.getCheats().add(argv[++i])) {
+        fprintf(stderr, "Invalid cheat '%s', expected a Game Genie (ABC-DEF-GHI) "
+                        "or GameShark (01VVAAAA) code\n",
+                argv[i]);
+        return 1;
+      }
+    } else {
+      romPath = arg;
+    }
+  }
+  if (selfTest)
+    return runSelfTest() ? 0 : 1;
+
+  bus.updateWatchpoints();
+
+  ppu.setRenderWorker(renderThread);
+  fprintf(stderr, "Using %s line renderer%s\n", simd::implementation(),
+          renderThread ? " on a worker thread" : "");
+
+  if (!romPath.empty()) {
+    bus.loadCartridge(util::readFile(romPath));
+    fprintf(stderr, "Loaded Cartride!\n");
+    if (!engineGiven)
+      ppu.setEngine(engineForTitle(bus.getTitle()));
+  }
+  fprintf(stderr, "Using the %s PPU engine, F2 switches engines\n",
+          ppuEngineName(ppu.getEngine()));
+  if (!fastBoot) {
+    std::vector<uint8_t> boot = util::readFile("boot.bin");
+    if (boot.size() == 0x100) {
+      cpu.loadBoot(boot);
+    } else {
+      fprintf(stderr, "No boot.bin found, skipping the boot screen\n");
+      fastBoot = true;
+    }
+  }
+  if (fastBoot) {
+    cpu.skipBoot();
+    ppu.skipBoot();
+    bus.getJoypad().skipBoot();
   }
-  cpu.loadBoot(util::readFile("boot.bin"));
   // cpu.dumpBoot();
 
-  auto syncTimer = std::chrono::high_resolution_clock::now();
+  Joypad &joypad = bus.getJoypad();
+  if (!inputLogPath.empty() && !joypad.startLog(inputLogPath)) {
+    fprintf(stderr, "Could not open '%s' for the input log\n",
+            inputLogPath.c_str());
+    return 1;
+  }
+  if (!inputReplayPath.empty() && !joypad.replay(inputReplayPath)) {
+    fprintf(stderr, "Could not replay '%s', expected lines of 'cycle button "
+                    "0|1'\n",
+            inputReplayPath.c_str());
+    return 1;
+  }
+
+  if (printFrameHashes)
+    ppu.setFrameHashHandler(nullptr, printFrameHash, printLineHashes);
+
+  // Scaled with the same filter as screenshots.
+  std::unique_ptr<Recorder> recorder;
+  if (!recordTarget.empty()) {
+    recorder = std::make_unique<Recorder>(recordContainer, recordPolicy,
+                                          recordQueue, ppu.getPixelFormat(),
+                                          scaleFilter, scaleFactor);
+    if (!recorder->start(recordTarget)) {
+      fprintf(stderr, "Could not open '%s' for recording\n",
+              recordTarget.c_str());
+      return 1;
+    }
+    ppu.setRecorder(recorder.get());
+    fprintf(stderr, "Recording to %s\n", recordTarget.c_str());
+  }
+
+  // Speculative frames would hit watchpoints that the real run has not.
+  if (runAheadFrames > 0 && watching) {
+    fprintf(stderr, "Run-ahead does not work with watchpoints, disabled\n");
+    runAheadFrames = 0;
+  }
+  std::unique_ptr<RunAhead> runAhead;
+  if (runAheadFrames > 0) {
+    runAhead = std::make_unique<RunAhead>(cpu, bus, ppu, runAheadFrames);
+    fprintf(stderr, "Running %d frame%s ahead\n", runAheadFrames,
+            runAheadFrames == 1 ? "" : "s");
+  }
+
+  // Nobody watches a headless run, it goes as fast as it can.
+  Pacer pacer(60);
+  pacer.setThrottled(!headless);
 
   auto fpsCounter = std::chrono::high_resolution_clock::now();
 
   int cyclesPS = 0;
   int cyclesPF = 0;
   uint64_t cumulativeFrameTime = 0;
+  uint64_t runAheadTime = 0;
+  int framesRun = 0;
+  bool paused = false;
+  int status = 0;
 
-  std::thread th(startRenderLoop, &ppu);
+  std::thread th;
+  if (!headless)
+    th = std::thread(startRenderLoop, &ppu);
+  joypad.startFrame();
 
   while (!ppu.isClosed()) {
+    if (paused) {
+      if (!ppu.takeResume()) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        continue;
+      }
+      fprintf(stderr, "Resuming emulation\n");
+      cpu.clearBreakpoint();
+      paused = false;
+    }
+
     auto now = std::chrono::high_resolution_clock::now();
     auto fpsElapsed =
         std::chrono::duration_cast<std::chrono::seconds>(now - fpsCounter)
@@ -328,42 +678,101 @@ int main(int argc, char **argv) {
       cyclesPS++;
       cyclesPF++;
       ppu.step();
-      cpu.step();
+      joypad.step();
+      if (!cpu.step()) {
+        // Nothing can resume a headless run, it fails instead.
+        if (headless)
+          fprintf(stderr, "Hit breakpoint, stopping emulation\n");
+        else
+          fprintf(stderr, "Hit breakpoint, pausing emulation, F5 resumes\n");
+        cpu.dumpRegisters();
+        if (headless) {
+          status = 2;
+          ppu.close();
+        } else {
+          // A press from before the breakpoint does not count.
+          ppu.takeResume();
+          paused = true;
+        }
+        break;
+      }
 
       if (cyclesPF == 17'556) {
-        auto syncNow = std::chrono::high_resolution_clock::now();
-        auto syncTime = std::chrono::duration_cast<std::chrono::nanoseconds>(
-                            syncNow - syncTimer)
-                            .count();
-        // printf("Frame time: %f ms, did %i cycles\n", syncTime / 1'000'000.0f,
-        // cyclesPF);
-        cumulativeFrameTime += syncTime;
+        uint64_t frameTime = pacer.frameDone();
+        cumulativeFrameTime += frameTime;
+        ppu.getPerfStats().addFrame(frameTime, ppu.takeEmulationTime(),
+                                    runAheadTime, pacer.getOversleep(),
+                                    pacer.getLateness());
         cyclesPF = 0;
-
-        // TODO: fix this
-        if (syncTime < 1'000'000'000 / 60) {
-          uint64_t sleepTime = (1'000'000'000 / 60) - syncTime;
-		  // printf("Sleeping for: %f ms\n", sleepTime / 1'000'000.0f);
-		  std::this_thread::sleep_for(std::chrono::nanoseconds(sleepTime));
+        joypad.startFrame();
+        if (frameSkipper.isEnabled())
+          ppu.skipNextFrame(frameSkipper.skipNextFrame(pacer));
+        if (runAhead) {
+          uint64_t start = hostTime();
+          runAhead->speculate();
+          runAheadTime = hostTime() - start;
+          // Counted as run-ahead, not as PPU time of the next frame.
+          ppu.takeEmulationTime();
         }
-        syncTimer = std::chrono::high_resolution_clock::now();
+        if (++framesRun == frameLimit)
+          ppu.close();
         break;
       }
     }
 
     if (fpsElapsed > 1.0) {
       fpsCounter += std::chrono::seconds(1);
-      printf("FPS: %d\n", ppu.getFrame());
-      printf("CYCLES: %d\n", cyclesPS);
-      printf("Time per frame: %f\n",
-             (cumulativeFrameTime / (float)ppu.getFrame()) / 1'000'000.0f);
+      int changed = ppu.takePublishedFrames();
+      int skipped = frameSkipper.takeSkippedFrames();
+      ppu.getPerfStats().addSecond(cyclesPS, ppu.getFrame(), changed, skipped);
+      // On stderr, stdout is for frame hashes.
+      fprintf(stderr, "FPS: %d (%d changed, %d skipped)\n", ppu.getFrame(),
+              changed, skipped);
+      fprintf(stderr, "CYCLES: %d\n", cyclesPS);
+      fprintf(stderr,
+              "Time per frame: %f (lateness %.2f frames, oversleep %.3f ms)\n",
+              (cumulativeFrameTime / (float)ppu.getFrame()) / 1'000'000.0f,
+              pacer.getLateness(), pacer.getOversleep() / 1'000'000.0f);
+      bus.getCounters().report(stderr);
+      if (ppu.getInputLatency().count())
+        ppu.getInputLatency().report(stderr);
+      if (!metricsPath.empty() && !writeMetricsFile(metricsPath, bus, ppu))
+        fprintf(stderr, "Could not write metrics to '%s'\n",
+                metricsPath.c_str());
       ppu.setFrame(0);
       cyclesPS = 0;
       cumulativeFrameTime = 0;
     }
   }
 
-  th.join();
+  if (th.joinable())
+    th.join();
+
+  if (!metricsPath.empty() && !writeMetricsFile(metricsPath, bus, ppu)) {
+    fprintf(stderr, "Could not write metrics to '%s'\n", metricsPath.c_str());
+    return 1;
+  }
+
+  if (recorder) {
+    ppu.setRecorder(nullptr);
+    if (!recorder->stop())
+      fprintf(stderr, "Writing the recording failed\n");
+    fprintf(stderr, "Recorded %d frames, %d dropped\n",
+            recorder->getWrittenFrames(), recorder->getDroppedFrames());
+  }
+
+  if (!screenshotPath.empty()) {
+    // Lets the render worker finish the last frame first.
+    ppu.setRenderWorker(false);
+    Scaler scaler(scaleFilter, scaleFactor);
+    if (!saveScreenshot(ppu, scaler, screenshotPath)) {
+      fprintf(stderr, "Could not write screenshot '%s'\n",
+              screenshotPath.c_str());
+      return 1;
+    }
+    fprintf(stderr, "Wrote %s screenshot at %dx to %s\n",
+            scaleFilterName(scaleFilter), scaleFactor, screenshotPath.c_str());
+  }
 
-  return 0;
+  return status;
 }
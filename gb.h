@@ -10,6 +10,32 @@
 class Instruction;
 
 class CPU {
+public:
+  // Everything that changes while the CPU runs, so it can be put back later.
+  struct State {
+    std::vector<uint8_t> ram;
+    std::vector<uint8_t> zeropage;
+    RegisterBank registers;
+    // Cloned on save and on load, it keeps running after either.
+    std::unique_ptr<Instruction> instr;
+    uint16_t clockCycle;
+    bool previousANDresult;
+    bool timerHasOverflowed;
+    uint16_t DIV;
+    uint8_t TIMA;
+    uint8_t TMA;
+    uint8_t TAC;
+    uint8_t IF;
+    uint8_t IE;
+    bool interruptsEnabled;
+    bool interruptsShouldBeEnabled;
+    int8_t interruptChangeStateDelay;
+    bool halted;
+    bool hasRecoveredFromHalt;
+    bool unlockedBootRom;
+  };
+
+private:
   std::vector<uint8_t> boot;
   std::vector<uint8_t> ram;
   std::vector<uint8_t> zeropage;
@@ -40,6 +66,8 @@ class CPU {
 
   bool breakpoint = false;
 
+  void connectIO(IORegisters &io);
+
 public:
   CPU(Bus *bus);
 
@@ -55,14 +83,27 @@ public:
     hasRecoveredFromHalt = true;
   }
   bool hasHalted() { return halted; }
+  void triggerBreakpoint() { breakpoint = true; }
+  void clearBreakpoint() { breakpoint = false; }
   RegisterBank &getRegisters() { return registers; }
 
   void raiseInterrupt(int interrupt);
 
   uint8_t read(uint16_t addr);
   void write(uint16_t addr, uint8_t value);
+  // HRAM without the watchpoint check, for cheats.
+  void writeZeropage(uint16_t addr, uint8_t value) {
+    zeropage[addr - 0xFF80] = value;
+  }
 
   void loadBoot(std::vector<uint8_t> boot) { this->boot = boot; }
+  // Puts the CPU in the state the boot ROM leaves it in, the cartridge has to
+  // be loaded first.
+  void skipBoot();
+
+  // Copies the state in memory, reusing what state already holds.
+  void saveState(State &state) const;
+  void loadState(const State &state);
 
   void dumpBoot();
   void dumpRam();
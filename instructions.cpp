@@ -1266,7 +1266,7 @@ bool Load::execute(CPU *cpu) {
         LOG("Wrote 0x%02X from %s to %04X\n", *src,
             registerNames[source].c_str(), address);
       } else {
-        printf("HALT\n");
+        fprintf(stderr, "HALT\n");
         while (true)
           ;
       }
@@ -50,6 +50,10 @@ public:
 
   virtual std::string getName() { return "BaseInstruction"; }
   virtual int getType() { return instruction::NoInstruction; }
+  // A copy that continues where this one is, for CPU snapshots.
+  virtual std::unique_ptr<Instruction> clone() const {
+    return std::make_unique<Instruction>(*this);
+  }
 };
 
 namespace instruction {
@@ -66,6 +70,9 @@ public:
 
   virtual std::string getName() override;
   virtual int getType() override;
+  virtual std::unique_ptr<Instruction> clone() const override {
+    return std::make_unique<Halt>(*this);
+  }
 };
 
 class DAA : public Instruction {
@@ -78,6 +85,9 @@ public:
 
   virtual std::string getName() override;
   virtual int getType() override;
+  virtual std::unique_ptr<Instruction> clone() const override {
+    return std::make_unique<DAA>(*this);
+  }
 };
 
 class Complement : public Instruction {
@@ -90,6 +100,9 @@ public:
 
   virtual std::string getName() override;
   virtual int getType() override;
+  virtual std::unique_ptr<Instruction> clone() const override {
+    return std::make_unique<Complement>(*this);
+  }
 };
 
 class SetClearCarryFlag : public Instruction {
@@ -104,6 +117,9 @@ public:
 
   virtual std::string getName() override;
   virtual int getType() override;
+  virtual std::unique_ptr<Instruction> clone() const override {
+    return std::make_unique<SetClearCarryFlag>(*this);
+  }
 };
 
 class SpecialAdd : public Instruction {
@@ -121,6 +137,9 @@ public:
 
   virtual std::string getName() override;
   virtual int getType() override;
+  virtual std::unique_ptr<Instruction> clone() const override {
+    return std::make_unique<SpecialAdd>(*this);
+  }
 };
 
 class EnableDisableInterrupts : public Instruction {
@@ -135,6 +154,9 @@ public:
 
   virtual std::string getName() override;
   virtual int getType() override;
+  virtual std::unique_ptr<Instruction> clone() const override {
+    return std::make_unique<EnableDisableInterrupts>(*this);
+  }
 };
 
 class RotateA : public Instruction {
@@ -150,6 +172,9 @@ public:
 
   virtual std::string getName() override;
   virtual int getType() override;
+  virtual std::unique_ptr<Instruction> clone() const override {
+    return std::make_unique<RotateA>(*this);
+  }
 };
 
 class PopPush : public Instruction {
@@ -167,6 +192,9 @@ public:
 
   virtual std::string getName() override;
   virtual int getType() override;
+  virtual std::unique_ptr<Instruction> clone() const override {
+    return std::make_unique<PopPush>(*this);
+  }
 };
 
 class Ret : public Instruction {
@@ -186,6 +214,9 @@ public:
 
   virtual std::string getName() override;
   virtual int getType() override;
+  virtual std::unique_ptr<Instruction> clone() const override {
+    return std::make_unique<Ret>(*this);
+  }
 };
 
 class Call : public Instruction {
@@ -205,6 +236,9 @@ public:
 
   virtual std::string getName() override;
   virtual int getType() override;
+  virtual std::unique_ptr<Instruction> clone() const override {
+    return std::make_unique<Call>(*this);
+  }
 };
 
 class IncDec : public Instruction {
@@ -225,6 +259,9 @@ public:
 
   virtual std::string getName() override;
   virtual int getType() override;
+  virtual std::unique_ptr<Instruction> clone() const override {
+    return std::make_unique<IncDec>(*this);
+  }
 };
 
 class ExtendedInstruction : public Instruction {
@@ -244,6 +281,9 @@ public:
 
   virtual std::string getName() override;
   virtual int getType() override;
+  virtual std::unique_ptr<Instruction> clone() const override {
+    return std::make_unique<ExtendedInstruction>(*this);
+  }
 };
 
 class RST : public Instruction {
@@ -259,6 +299,9 @@ public:
 
   virtual std::string getName() override;
   virtual int getType() override;
+  virtual std::unique_ptr<Instruction> clone() const override {
+    return std::make_unique<RST>(*this);
+  }
 };
 
 class ALU : public Instruction {
@@ -279,6 +322,9 @@ public:
 
   virtual std::string getName() override;
   virtual int getType() override;
+  virtual std::unique_ptr<Instruction> clone() const override {
+    return std::make_unique<ALU>(*this);
+  }
 };
 
 class Load : public Instruction {
@@ -311,6 +357,9 @@ public:
 
   virtual std::string getName() override;
   virtual int getType() override;
+  virtual std::unique_ptr<Instruction> clone() const override {
+    return std::make_unique<Load>(*this);
+  }
 };
 
 class Jump : public Instruction {
@@ -332,6 +381,9 @@ public:
 
   virtual std::string getName() override;
   virtual int getType() override;
+  virtual std::unique_ptr<Instruction> clone() const override {
+    return std::make_unique<Jump>(*this);
+  }
 };
 
 class Nop : public Instruction {
@@ -344,6 +396,9 @@ public:
 
   virtual std::string getName() override;
   virtual int getType() override;
+  virtual std::unique_ptr<Instruction> clone() const override {
+    return std::make_unique<Nop>(*this);
+  }
 };
 
 class Unsupported : public Instruction {
@@ -356,4 +411,7 @@ public:
 
   virtual std::string getName() override { return "Unsupported"; }
   virtual int getType() override { return instruction::Unsupported; }
+  virtual std::unique_ptr<Instruction> clone() const override {
+    return std::make_unique<Unsupported>(*this);
+  }
 };
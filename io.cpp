@@ -0,0 +1,66 @@
+#include "io.h"
+
+#include <cstring>
+
+IORegisters::IORegisters(AccessCounters &counters) : counters(counters) {
+  for (int i = 0; i < IO_SIZE; i++) {
+    registers[i] = 0xFF;
+    handlers[i] = {readOpenBus, this, writeIgnored, this};
+  }
+}
+
+uint8_t IORegisters::readOpenBus(void *context, uint16_t addr) {
+  static_cast<IORegisters *>(context)->counters.count(
+      AccessClass::UnconnectedIORead, addr);
+  return 0xFF;
+}
+
+void IORegisters::writeIgnored(void *context, uint16_t addr, uint8_t value) {
+  static_cast<IORegisters *>(context)->counters.count(
+      AccessClass::UnconnectedIOWrite, addr);
+}
+
+uint8_t IORegisters::readStorage(void *context, uint16_t addr) {
+  return static_cast<IORegisters *>(context)->registers[addr - IO_BASE];
+}
+
+void IORegisters::writeStorage(void *context, uint16_t addr, uint8_t value) {
+  static_cast<IORegisters *>(context)->registers[addr - IO_BASE] = value;
+}
+
+void IORegisters::connect(uint16_t addr, void *context, ReadHandler read,
+                          WriteHandler write) {
+  Handler &handler = handlers[addr - IO_BASE];
+  handler.read = read ? read : readOpenBus;
+  handler.readContext = read ? context : this;
+  handler.write = write ? write : writeIgnored;
+  handler.writeContext = write ? context : this;
+}
+
+void IORegisters::connectStorage(uint16_t addr, uint8_t initial) {
+  registers[addr - IO_BASE] = initial;
+  handlers[addr - IO_BASE] = {readStorage, this, writeStorage, this};
+}
+
+void IORegisters::disconnect(uint16_t addr) {
+  registers[addr - IO_BASE] = 0xFF;
+  handlers[addr - IO_BASE] = {readOpenBus, this, writeIgnored, this};
+}
+
+bool IORegisters::isConnected(uint16_t addr) const {
+  const Handler &handler = handlers[addr - IO_BASE];
+  return handler.read != readOpenBus || handler.write != writeIgnored;
+}
+
+void IORegisters::saveState(uint8_t state[IO_SIZE]) const {
+  memcpy(state, registers, IO_SIZE);
+}
+
+void IORegisters::loadState(const uint8_t state[IO_SIZE]) {
+  memcpy(registers, state, IO_SIZE);
+}
+
+void IORegisters::setTrace(void *context, TraceHandler trace) {
+  this->trace = trace;
+  traceContext = context;
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include "counters.h"
+
+#include <cstdint>
+
+constexpr uint16_t IO_BASE = 0xFF00;
+constexpr uint16_t IO_SIZE = 0x80;
+
+// Register file for the memory mapped I/O at 0xFF00-0xFF7F.
+//
+// Every register has a read and a write handler which the owning component
+// (CPU, PPU, Bus) connects when it is constructed, so an access is a single
+// table lookup instead of a chain of address comparisons. Registers that
+// nobody connects behave like open bus: reads return 0xFF and writes are
+// dropped, and both are counted in the bus access counters.
+class IORegisters {
+public:
+  using ReadHandler = uint8_t (*)(void *context, uint16_t addr);
+  using WriteHandler = void (*)(void *context, uint16_t addr, uint8_t value);
+  using TraceHandler = void (*)(void *context, uint16_t addr, uint8_t value,
+                                bool write);
+
+private:
+  // Each direction has its own context, the open bus defaults need the
+  // register file while the other direction goes to a component.
+  struct Handler {
+    ReadHandler read;
+    void *readContext;
+    WriteHandler write;
+    void *writeContext;
+  };
+
+  AccessCounters &counters;
+
+  uint8_t registers[IO_SIZE];
+  Handler handlers[IO_SIZE];
+
+  TraceHandler trace = nullptr;
+  void *traceContext = nullptr;
+
+  static uint8_t readOpenBus(void *context, uint16_t addr);
+  static void writeIgnored(void *context, uint16_t addr, uint8_t value);
+  static uint8_t readStorage(void *context, uint16_t addr);
+  static void writeStorage(void *context, uint16_t addr, uint8_t value);
+
+public:
+  IORegisters(AccessCounters &counters);
+
+  // Connects a register to a component. A null handler keeps the open bus
+  // behaviour for that direction.
+  void connect(uint16_t addr, void *context, ReadHandler read,
+               WriteHandler write);
+  // Connects a register that only stores what is written to it.
+  void connectStorage(uint16_t addr, uint8_t initial = 0);
+  void disconnect(uint16_t addr);
+  bool isConnected(uint16_t addr) const;
+
+  // Copies what the storage registers hold, for snapshots.
+  void saveState(uint8_t state[IO_SIZE]) const;
+  void loadState(const uint8_t state[IO_SIZE]);
+
+  // Called for every I/O access while set, pass nullptr to disable.
+  void setTrace(void *context, TraceHandler trace);
+
+  uint8_t read(uint16_t addr) {
+    const Handler &handler = handlers[addr - IO_BASE];
+    uint8_t value = handler.read(handler.readContext, addr);
+    if (trace)
+      trace(traceContext, addr, value, false);
+    return value;
+  }
+
+  void write(uint16_t addr, uint8_t value) {
+    const Handler &handler = handlers[addr - IO_BASE];
+    if (trace)
+      trace(traceContext, addr, value, true);
+    handler.write(handler.writeContext, addr, value);
+  }
+};
@@ -0,0 +1,179 @@
+#include "joypad.h"
+
+#include <algorithm>
+
+#include "bus.h"
+
+constexpr uint8_t interruptInput = 1 << 4;
+constexpr uint64_t cyclesPerFrame = 17556;
+
+namespace {
+
+const char *const buttonNames[] = {"right", "left",   "up",   "down",
+                                   "a",     "b",      "select", "start"};
+
+} // namespace
+
+const char *buttonName(Button button) {
+  return buttonNames[static_cast<int>(button)];
+}
+
+bool parseButton(const std::string &name, Button &button) {
+  for (int i = 0; i < 8; i++) {
+    if (name == buttonNames[i]) {
+      button = static_cast<Button>(i);
+      return true;
+    }
+  }
+  return false;
+}
+
+Joypad::Joypad(Bus *bus) : bus(bus) {
+  bus->getIO().connect(
+      0xFF00, this,
+      [](void *joypad, uint16_t addr) -> uint8_t {
+        Joypad *instance = static_cast<Joypad *>(joypad);
+        if (instance->appliedInput.hostTime) {
+          instance->readInput.merge(instance->appliedInput);
+          instance->appliedInput = {};
+        }
+        return instance->P1;
+      },
+      [](void *joypad, uint16_t addr, uint8_t value) {
+        Joypad *instance = static_cast<Joypad *>(joypad);
+        instance->select = value & 0b00110000;
+        instance->updateP1();
+      });
+}
+
+Joypad::~Joypad() {
+  if (log)
+    fclose(log);
+}
+
+void Joypad::skipBoot() {
+  select = 0b00110000;
+  updateP1();
+}
+
+void Joypad::press(Button button, bool pressed) {
+  uint8_t bit = 1 << static_cast<int>(button);
+  if (((hostButtons & bit) != 0) == pressed)
+    return;
+
+  // Dropped when the emulation is not taking input, e.g. while paused. The
+  // button then still counts as released and the next press gets through.
+  uint32_t tail = queueTail.load(std::memory_order_relaxed);
+  if (tail - queueHead.load(std::memory_order_acquire) == queueCapacity)
+    return;
+  hostButtons ^= bit;
+  queue[tail % queueCapacity] = {hostTime(), button, pressed};
+  queueTail.store(tail + 1, std::memory_order_release);
+}
+
+void Joypad::startFrame() {
+  uint64_t start = hostTime();
+  uint64_t previousStart = frameStartTime;
+  frameStartTime = start;
+
+  uint32_t head = queueHead.load(std::memory_order_relaxed);
+  uint32_t tail = queueTail.load(std::memory_order_acquire);
+  for (; head != tail; head++) {
+    const HostEvent &event = queue[head % queueCapacity];
+    if (replaying)
+      continue;
+    uint64_t offset = 0;
+    if (previousStart != 0 && event.time > previousStart)
+      offset = std::min((event.time - previousStart) * cyclesPerFrame /
+                            (start - previousStart),
+                        cyclesPerFrame - 1);
+    schedule({cycle + offset, event.button, event.pressed, event.time});
+  }
+  queueHead.store(head, std::memory_order_release);
+}
+
+void Joypad::schedule(Event event) {
+  if (!scheduled.empty())
+    event.cycle = std::max(event.cycle, scheduled.back().cycle);
+  scheduled.push_back(event);
+  nextEventCycle = scheduled.front().cycle;
+}
+
+void Joypad::applyEvents() {
+  while (!scheduled.empty() && scheduled.front().cycle <= cycle) {
+    const Event &event = scheduled.front();
+    uint8_t bit = 1 << static_cast<int>(event.button);
+    buttons = event.pressed ? buttons | bit : buttons & ~bit;
+    if (log && !speculating)
+      fprintf(log, "%llu %s %d\n", (unsigned long long)cycle,
+              buttonName(event.button), event.pressed);
+    if (event.hostTime > lastStampedTime) {
+      if (!appliedInput.hostTime)
+        appliedInput = {event.hostTime, hostTime()};
+      lastStampedTime = event.hostTime;
+    }
+    updateP1();
+    scheduled.pop_front();
+  }
+  nextEventCycle = scheduled.empty() ? UINT64_MAX : scheduled.front().cycle;
+}
+
+void Joypad::updateP1() {
+  uint8_t lines = 0b1111;
+  if (!(select & 0b00100000))
+    lines &= ~(buttons >> 4);
+  if (!(select & 0b00010000))
+    lines &= ~(buttons & 0b1111);
+
+  // The interrupt is requested when an input line goes low, by pressing a
+  // button or by selecting a group a button is held in.
+  if (P1 & ~lines & 0b1111)
+    bus->raiseInterrupt(interruptInput);
+  P1 = select | lines;
+}
+
+void Joypad::saveState(State &state) const {
+  state.select = select;
+  state.buttons = buttons;
+  state.P1 = P1;
+  state.cycle = cycle;
+  state.nextEventCycle = nextEventCycle;
+  state.scheduled = scheduled;
+}
+
+void Joypad::loadState(const State &state) {
+  select = state.select;
+  buttons = state.buttons;
+  P1 = state.P1;
+  cycle = state.cycle;
+  nextEventCycle = state.nextEventCycle;
+  scheduled = state.scheduled;
+}
+
+bool Joypad::startLog(const std::string &path) {
+  log = fopen(path.c_str(), "w");
+  return log != nullptr;
+}
+
+bool Joypad::replay(const std::string &path) {
+  FILE *file = fopen(path.c_str(), "r");
+  if (!file)
+    return false;
+
+  unsigned long long eventCycle;
+  char name[16];
+  int pressed;
+  bool valid = true;
+  while (fscanf(file, "%llu %15s %d", &eventCycle, name, &pressed) == 3) {
+    Button button;
+    if (!parseButton(name, button)) {
+      valid = false;
+      break;
+    }
+    schedule({eventCycle, button, pressed != 0});
+  }
+  valid = valid && feof(file);
+  fclose(file);
+  replaying = true;
+  return valid;
+}
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <string>
+
+#include "latency.h"
+
+class Bus;
+
+enum class Button : uint8_t { Right, Left, Up, Down, A, B, Select, Start };
+
+const char *buttonName(Button button);
+bool parseButton(const std::string &name, Button &button);
+
+// The buttons and the P1 register (0xFF00).
+//
+// Host input arrives on the window's thread through a single producer,
+// single consumer queue, stamped with the time it arrived. When a frame
+// starts, the emulation maps what arrived during the previous frame onto
+// the cycles of the new one, at the same relative position. Input
+// therefore always lands one frame later, and where it lands only depends
+// on when it was made, not on when the emulation got to look at it. Events
+// are applied on their cycle, and can be logged and replayed.
+class Joypad {
+public:
+  struct Event {
+    uint64_t cycle;
+    Button button;
+    bool pressed;
+    // When the event arrived from the host, zero for replayed events.
+    uint64_t hostTime = 0;
+  };
+
+  // What the emulation changes. Host input still queued, the log and the
+  // latency stamps are not part of it.
+  struct State {
+    uint8_t select;
+    uint8_t buttons;
+    uint8_t P1;
+    uint64_t cycle;
+    uint64_t nextEventCycle;
+    std::deque<Event> scheduled;
+  };
+
+private:
+  struct HostEvent {
+    uint64_t time;
+    Button button;
+    bool pressed;
+  };
+
+  static constexpr uint32_t queueCapacity = 256;
+
+  HostEvent queue[queueCapacity];
+  std::atomic<uint32_t> queueHead{0};
+  std::atomic<uint32_t> queueTail{0};
+  // Buttons held on the host, only used by the producer to drop repeats.
+  uint8_t hostButtons = 0;
+
+  Bus *bus;
+  // P14 and P15 as last written, deselecting the directions and buttons.
+  uint8_t select = 0;
+  // Bit 1 << Button is set for every pressed button.
+  uint8_t buttons = 0;
+  // Kept up to date, so reads are a plain load.
+  uint8_t P1 = 0x0F;
+
+  uint64_t cycle = 0;
+  uint64_t nextEventCycle = UINT64_MAX;
+  std::deque<Event> scheduled;
+  uint64_t frameStartTime = 0;
+  bool replaying = false;
+  FILE *log = nullptr;
+  // Events applied while speculating are applied again for real later, so
+  // they are neither logged nor stamped twice.
+  bool speculating = false;
+  uint64_t lastStampedTime = 0;
+  // The earliest host input applied since P1 was last read, and the
+  // earliest one read since the PPU last took it.
+  InputStamp appliedInput;
+  InputStamp readInput;
+
+  void applyEvents();
+  void updateP1();
+
+public:
+  Joypad(Bus *bus);
+  ~Joypad();
+
+  void skipBoot();
+
+  // Host side, can be called from one other thread.
+  void press(Button button, bool pressed);
+
+  // Called once per cycle, applies the events due.
+  void step() {
+    if (++cycle >= nextEventCycle)
+      applyEvents();
+  }
+  // Called when a frame starts, schedules the host input that arrived since
+  // the last frame started.
+  void startFrame();
+  // Events have to be scheduled in order.
+  void schedule(Event event);
+  // Host input the game read since the last call, for measuring latency.
+  InputStamp takeReadInput() {
+    InputStamp input = readInput;
+    readInput = {};
+    return input;
+  }
+
+  void saveState(State &state) const;
+  void loadState(const State &state);
+  // While set, applied events are not logged, see RunAhead.
+  void setSpeculating(bool speculating) { this->speculating = speculating; }
+
+  // Writes every applied event to path, in the format replay() reads.
+  bool startLog(const std::string &path);
+  // Schedules the events logged in path and ignores host input from then on.
+  bool replay(const std::string &path);
+};
@@ -0,0 +1,101 @@
+#include "latency.h"
+
+#include <algorithm>
+#include <chrono>
+
+uint64_t hostTime() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+void LatencyHistogram::add(uint64_t nanoseconds) {
+  int index = std::min<uint64_t>(nanoseconds / 1'000'000, bucketCount - 1);
+  buckets[index].fetch_add(1, std::memory_order_relaxed);
+  if (nanoseconds > maximum.load(std::memory_order_relaxed))
+    maximum.store(nanoseconds, std::memory_order_relaxed);
+  sum.fetch_add(nanoseconds, std::memory_order_relaxed);
+  samples.fetch_add(1, std::memory_order_relaxed);
+}
+
+int LatencyHistogram::percentile(float fraction) const {
+  uint32_t total = 0;
+  for (int i = 0; i < bucketCount; i++)
+    total += buckets[i];
+  uint32_t wanted = std::max<uint32_t>(total * fraction + 0.5f, 1);
+  uint32_t seen = 0;
+  for (int i = 0; i < bucketCount; i++) {
+    seen += buckets[i];
+    if (seen >= wanted)
+      return i + 1;
+  }
+  return bucketCount;
+}
+
+const char *latencyStageName(LatencyStage stage) {
+  switch (stage) {
+  case LatencyStage::Queue:
+    return "queue";
+  case LatencyStage::Emulation:
+    return "emulation";
+  case LatencyStage::Presentation:
+    return "presentation";
+  case LatencyStage::Total:
+    return "total";
+  }
+  return "";
+}
+
+void InputLatency::add(const InputStamp &stamp, uint64_t presentedTime) {
+  // The steps happen in order on the same clock, but threads can read it a
+  // little out of order.
+  auto since = [](uint64_t later, uint64_t earlier) {
+    return later > earlier ? later - earlier : 0;
+  };
+  stages[0].add(since(stamp.appliedTime, stamp.hostTime));
+  stages[1].add(since(stamp.publishedTime, stamp.appliedTime));
+  stages[2].add(since(presentedTime, stamp.publishedTime));
+  stages[3].add(since(presentedTime, stamp.hostTime));
+}
+
+void InputLatency::report(FILE *out) const {
+  fprintf(out, "Input latency (%u presses, ms):\n", count());
+  for (int i = 0; i < latencyStageCount; i++) {
+    const LatencyHistogram &histogram = stages[i];
+    if (!histogram.count())
+      continue;
+    fprintf(out, "  %-12s p50 %3d  p90 %3d  p99 %3d  max %6.1f  |",
+            latencyStageName(static_cast<LatencyStage>(i)),
+            histogram.percentile(0.5f), histogram.percentile(0.9f),
+            histogram.percentile(0.99f), histogram.maximumMs());
+    // Filled buckets by their lower edge, the last one is open ended.
+    for (int b = 0; b < LatencyHistogram::bucketCount; b++)
+      if (uint32_t n = histogram.bucket(b))
+        fprintf(out, " %d%s:%u", b,
+                b == LatencyHistogram::bucketCount - 1 ? "+" : "", n);
+    fprintf(out, "\n");
+  }
+}
+
+void InputLatency::writeMetrics(FILE *out) const {
+  for (int i = 0; i < latencyStageCount; i++) {
+    const LatencyHistogram &histogram = stages[i];
+    const char *name = latencyStageName(static_cast<LatencyStage>(i));
+    uint32_t total = histogram.count();
+    if (!total)
+      continue;
+    // Bucket b holds [b, b + 1) ms, the open ended last one only shows up
+    // in +Inf.
+    uint32_t cumulative = 0;
+    for (int b = 0; b < LatencyHistogram::bucketCount - 1; b++) {
+      cumulative += histogram.bucket(b);
+      fprintf(out, "gb_input_latency_ms_bucket{stage=\"%s\",le=\"%d\"} %u\n",
+              name, b + 1, cumulative);
+    }
+    fprintf(out, "gb_input_latency_ms_bucket{stage=\"%s\",le=\"+Inf\"} %u\n",
+            name, total);
+    fprintf(out, "gb_input_latency_ms_sum{stage=\"%s\"} %.3f\n", name,
+            histogram.sumMs());
+    fprintf(out, "gb_input_latency_ms_count{stage=\"%s\"} %u\n", name, total);
+  }
+}
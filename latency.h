@@ -0,0 +1,83 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+
+// Nanoseconds on the steady clock, the time base of every input stamp.
+uint64_t hostTime();
+
+// When a host input event went through each step on its way to the screen.
+// Travels from the joypad to the frame the game read the input in, and with
+// that frame to the presenter. Zero means the step has not happened, a
+// hostTime of zero means there is no input to measure.
+struct InputStamp {
+  // Arrived from the window.
+  uint64_t hostTime = 0;
+  // Applied to the joypad on its emulated cycle.
+  uint64_t appliedTime = 0;
+  // The frame the game read it in was handed to the presenter.
+  uint64_t publishedTime = 0;
+
+  // Keeps the earliest of two inputs.
+  void merge(const InputStamp &other) {
+    if (other.hostTime && (!hostTime || other.hostTime < hostTime))
+      *this = other;
+  }
+};
+
+// Latencies in 1 ms buckets, filled on one thread and read on any other.
+class LatencyHistogram {
+public:
+  // The last bucket also holds everything slower.
+  static constexpr int bucketCount = 100;
+
+private:
+  std::atomic<uint32_t> buckets[bucketCount] = {};
+  std::atomic<uint32_t> samples{0};
+  std::atomic<uint64_t> maximum{0};
+  std::atomic<uint64_t> sum{0};
+
+public:
+  void add(uint64_t nanoseconds);
+
+  uint32_t count() const { return samples; }
+  uint32_t bucket(int index) const { return buckets[index]; }
+  // Upper edge in ms of the bucket that holds the given fraction of the
+  // samples.
+  int percentile(float fraction) const;
+  float maximumMs() const { return maximum / 1'000'000.0f; }
+  float sumMs() const { return sum / 1'000'000.0f; }
+};
+
+enum class LatencyStage : uint8_t {
+  Queue,        // Key event to the joypad applying it.
+  Emulation,    // Applied to the frame the game read it in being published.
+  Presentation, // Published to the buffer swap showing it.
+  Total,        // Key event to the buffer swap.
+};
+
+constexpr int latencyStageCount = 4;
+
+const char *latencyStageName(LatencyStage stage);
+
+// End to end input latency, from the key event to the first frame presented
+// after the game read the input, split into stages.
+class InputLatency {
+  LatencyHistogram stages[latencyStageCount];
+
+public:
+  // Called by the presenter once a frame carrying input was shown.
+  void add(const InputStamp &stamp, uint64_t presentedTime);
+
+  const LatencyHistogram &get(LatencyStage stage) const {
+    return stages[static_cast<int>(stage)];
+  }
+  uint32_t count() const { return get(LatencyStage::Total).count(); }
+
+  // Prints percentiles and the filled buckets of every stage.
+  void report(FILE *out) const;
+  // Dumps every stage with samples as a cumulative
+  // "gb_input_latency_ms_bucket{stage,le} count" histogram for scraping.
+  void writeMetrics(FILE *out) const;
+};
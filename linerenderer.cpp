@@ -0,0 +1,294 @@
+#include "linerenderer.h"
+#include "recorder.h"
+#include "simd.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+
+const DMGPalette dmgPalettes[] = {
+    {"default", {0xf7bef7, 0xe78686, 0x7733e7, 0x2c2c96}},
+    {"grey", {0xffffff, 0xaaaaaa, 0x555555, 0x000000}},
+    {"green", {0x9bbc0f, 0x8bac0f, 0x306230, 0x0f380f}},
+    {"pocket", {0xc4cfa1, 0x8b956d, 0x4d533c, 0x1f1f1f}},
+};
+const int dmgPaletteCount = sizeof(dmgPalettes) / sizeof(dmgPalettes[0]);
+
+LineRenderer::LineRenderer()
+    : vram(0x2000), oam(0xA0), tileCache(vram.data()) {
+  setPixelFormat(PixelFormat::RGB888);
+  std::fill(std::begin(changedTiles), std::end(changedTiles), ~0ull);
+}
+
+void LineRenderer::write(uint16_t addr, uint8_t value) {
+  if (addr >= 0x8000 && addr < 0xA000) {
+    if (vram[addr - 0x8000] == value)
+      return;
+    vram[addr - 0x8000] = value;
+    tileCache.invalidate(addr - 0x8000);
+    if (addr < 0x9800) {
+      uint16_t tile = (addr - 0x8000) / 16;
+      changedTiles[tile / 64] |= 1ull << (tile % 64);
+    }
+  } else if (addr >= 0xFE00 && addr < 0xFEA0) {
+    oam[addr - 0xFE00] = value;
+  }
+}
+
+void LineRenderer::updatePaletteTables(const LineRegisters &registers) {
+  if (registers.BGP == BGP && registers.OBP0 == OBP0 &&
+      registers.OBP1 == OBP1)
+    return;
+  BGP = registers.BGP;
+  OBP0 = registers.OBP0;
+  OBP1 = registers.OBP1;
+  for (int color = 0; color < 4; color++) {
+    backgroundShades[color] = (BGP >> (2 * color)) & 0x3;
+    spriteShades[0][color] = (OBP0 >> (2 * color)) & 0x3;
+    spriteShades[1][color] = (OBP1 >> (2 * color)) & 0x3;
+  }
+}
+
+void LineRenderer::resolveColors() {
+  resolvedPalette = palette;
+  for (int shade = 0; shade < 4; shade++)
+    outputColors[shade] = packColor(
+        pixelFormat, dmgPalettes[resolvedPalette].colors[shade], shade);
+  allLinesDirty = true;
+}
+
+void LineRenderer::setPixelFormat(PixelFormat format) {
+  pixelFormat = format;
+  frames.resize(WIDTH * HEIGHT * bytesPerPixel(format), TILE_COUNT * 16);
+  resolveColors();
+}
+
+void LineRenderer::finishFrame(bool skipped, const InputStamp &input) {
+  WLY = 0;
+  pendingInput.merge(input);
+
+  // Every line of the back frame was just written, whether it changed or
+  // not.
+  if (recorder)
+    recorder->addFrame(skipped ? nullptr : frames.backBuffer().pixels.data(),
+                       dmgPalettes[resolvedPalette].colors);
+  uint64_t frame = finishedFrames++;
+  if (hashHandler && !skipped)
+    hashHandler(hashContext,
+                {frame, hashFrame(), hashLines ? lineHashes : nullptr});
+  // Changes made during a skipped frame are published with the next one
+  // that is drawn.
+  if (skipped)
+    return;
+
+  uint64_t anyTileChanged = 0;
+  for (uint64_t bits : changedTiles)
+    anyTileChanged |= bits;
+  if (firstDirtyLine > lastDirtyLine && !anyTileChanged)
+    return;
+
+  Frame &finished = frames.backBuffer();
+  memcpy(finished.tiles.data(), vram.data(), finished.tiles.size());
+  finished.hash = hashFrame();
+  finished.firstDirtyLine = firstDirtyLine;
+  finished.lastDirtyLine = lastDirtyLine;
+  memcpy(finished.changedTiles, changedTiles, sizeof(changedTiles));
+  finished.sequence = ++frameSequence;
+  finished.input = pendingInput;
+  if (pendingInput.hostTime && !pendingInput.publishedTime)
+    finished.input.publishedTime = hostTime();
+  pendingInput = {};
+  // Input of a frame the presenter never saw is shown by the next one.
+  if (frames.publish())
+    pendingInput = frames.backBuffer().input;
+  publishedFrames++;
+
+  firstDirtyLine = HEIGHT;
+  lastDirtyLine = -1;
+  memset(changedTiles, 0, sizeof(changedTiles));
+  allLinesDirty = false;
+}
+
+uint64_t LineRenderer::hashFrame() const {
+  uint64_t hash = 0;
+  for (int y = 0; y < HEIGHT; y++)
+    hash = (hash ^ lineHashes[y]) * 0x100000001B3ull;
+  return hash;
+}
+
+void LineRenderer::drawLine(const LineRegisters &registers) {
+  uint8_t LY = registers.LY;
+  updatePaletteTables(registers);
+
+  uint16_t windowTileMap = registers.LCDC & (1 << 6) ? 0x1C00 : 0x1800;
+  bool showWindow = registers.LCDC & (1 << 5);
+  bool signedTileIndex = (registers.LCDC & (1 << 4)) == 0;
+  uint16_t bgTileMapDisplay = registers.LCDC & (1 << 3) ? 0x1C00 : 0x1800;
+  uint8_t spriteHeight = registers.LCDC & (1 << 2) ? 16 : 8;
+  bool showSprites = registers.LCDC & (1 << 1);
+  bool showBGAndWindow = registers.LCDC & 1;
+
+  showWindow = showWindow && registers.windowEnabled;
+  if (registers.WX > 166 || registers.WY > 143 || LY < registers.WY)
+    showWindow = false;
+
+  // Color indices of the background, one tile more than the screen is wide
+  // so that the fine scroll can be applied by offsetting into it.
+  uint8_t background[WIDTH + 8];
+  uint8_t *line = background + (registers.SCX % 8);
+  if (showBGAndWindow) {
+    uint8_t yy = LY + registers.SCY;
+    const uint8_t *tileMap = &vram[bgTileMapDisplay + (yy / 8) * 32];
+    for (int t = 0; t < WIDTH / 8 + 1; t++) {
+      uint8_t tile = tileMap[(registers.SCX / 8 + t) % 32];
+      memcpy(&background[8 * t],
+             tileCache.row(TileCache::index(tile, signedTileIndex), yy % 8,
+                           false),
+             8);
+    }
+  } else {
+    memset(background, 0, sizeof(background));
+  }
+
+  // With LCDC bit 0 off the window is blank like the background, but it
+  // still counts its lines.
+  if (showWindow && showBGAndWindow) {
+    uint8_t yw = WLY;
+    const uint8_t *tileMap = &vram[windowTileMap + (yw / 8) * 32];
+    for (int x = std::max(registers.WX - 7, 0); x < WIDTH; x++) {
+      uint8_t xw = x - registers.WX + 7;
+      uint8_t tile = tileMap[xw / 8];
+      line[x] = tileCache.row(TileCache::index(tile, signedTileIndex), yw % 8,
+                              false)[xw % 8];
+    }
+  }
+  if (showWindow)
+    WLY++;
+
+  uint8_t shades[WIDTH];
+  simd::mapPalette(line, WIDTH, backgroundShades, shades);
+
+  SpriteLine &sprites = lineSprites[LY];
+  selectSprites(oam.data(), LY, registers.LCDC, sprites);
+  if (showSprites && sprites.count > 0) {
+    // Sprites are drawn in priority order and the first one with a visible
+    // pixel claims it, even if the background then hides that pixel.
+    bool claimed[WIDTH + 8] = {};
+    for (int i = 0; i < sprites.count; i++) {
+      const Sprite &sprite = sprites.sprites[i];
+      uint8_t yt = (LY - (sprite.y - 16)) % 8;
+      yt = sprite.attributes & 0x40 ? (7 - yt) : yt;
+      bool flipX = sprite.attributes & 0x20;
+      uint8_t tile = sprite.tile;
+      if (spriteHeight == 16) {
+        uint8_t topSprite = sprite.attributes & 0x40 ? (sprite.tile | 0x1)
+                                                     : (sprite.tile & 0xFE);
+        tile = LY >= sprite.y - 8 ? topSprite ^ 0x1 : topSprite;
+      }
+      const uint8_t *row = tileCache.row(tile, yt, flipX);
+      const uint8_t *spritePalette =
+          spriteShades[(sprite.attributes >> 4) & 1];
+      bool bgPriority = sprite.attributes & 0x80;
+
+      for (int xt = 0; xt < 8; xt++) {
+        int x = sprite.x - 8 + xt;
+        if (x < 0 || x >= WIDTH || claimed[x] || row[xt] == 0)
+          continue;
+        claimed[x] = true;
+        if (!bgPriority || line[x] == 0)
+          shades[x] = spritePalette[row[xt]];
+      }
+    }
+  }
+
+  storeLine(LY, shades);
+}
+
+void LineRenderer::storeLine(uint8_t LY, const uint8_t *shades) {
+  if (LY == 0 && palette != resolvedPalette)
+    resolveColors();
+
+  uint64_t hash = hashLine(shades, WIDTH);
+  if (allLinesDirty || hash != lineHashes[LY]) {
+    lineHashes[LY] = hash;
+    firstDirtyLine = std::min<int>(firstDirtyLine, LY);
+    lastDirtyLine = std::max<int>(lastDirtyLine, LY);
+  }
+
+  // The back frame is reused, so every line is written even if unchanged.
+  uint8_t *out =
+      &frames.backBuffer().pixels[bytesPerPixel(pixelFormat) * WIDTH * LY];
+  switch (pixelFormat) {
+  case PixelFormat::RGB888:
+    for (int x = 0; x < WIDTH; x++) {
+      uint32_t color = outputColors[shades[x]];
+      out[3 * x] = (color >> 16) & 0xFF;
+      out[3 * x + 1] = (color >> 8) & 0xFF;
+      out[3 * x + 2] = color & 0xFF;
+    }
+    break;
+  case PixelFormat::RGBA8888: {
+    uint32_t line[WIDTH];
+    for (int x = 0; x < WIDTH; x++)
+      line[x] = outputColors[shades[x]];
+    memcpy(out, line, sizeof(line));
+    break;
+  }
+  case PixelFormat::RGB565: {
+    uint16_t line[WIDTH];
+    for (int x = 0; x < WIDTH; x++)
+      line[x] = outputColors[shades[x]];
+    memcpy(out, line, sizeof(line));
+    break;
+  }
+  case PixelFormat::Indexed:
+    memcpy(out, shades, WIDTH);
+    break;
+  }
+}
+
+void selectSprites(const uint8_t *oam, uint8_t LY, uint8_t LCDC,
+                   SpriteLine &selected) {
+  selected.count = 0;
+  if (!(LCDC & (1 << 1)))
+    return;
+
+  // OAM scan: the first ten sprites that overlap this line.
+  uint8_t spriteHeight = LCDC & (1 << 2) ? 16 : 8;
+  uint16_t keys[10];
+  for (int spIndex = 0; spIndex < 40 && selected.count < 10; spIndex++) {
+    uint8_t y = oam[4 * spIndex];
+    if (LY < y - 16 || LY >= y + spriteHeight - 16)
+      continue;
+
+    keys[selected.count++] = (oam[4 * spIndex + 1] << 8) | spIndex;
+  }
+  if (selected.count == 0)
+    return;
+
+  // Sorting network for ten keys. The OAM index in the low byte makes every
+  // key unique, so sprites at the same X stay in OAM order.
+  for (int i = selected.count; i < 10; i++)
+    keys[i] = 0xFFFF;
+  constexpr uint8_t network[29][2] = {
+      {4, 9}, {3, 8}, {2, 7}, {1, 6}, {0, 5}, {1, 4}, {6, 9}, {0, 3},
+      {5, 8}, {0, 2}, {3, 6}, {7, 9}, {0, 1}, {2, 4}, {5, 7}, {8, 9},
+      {1, 2}, {4, 6}, {7, 8}, {3, 5}, {2, 5}, {6, 8}, {1, 3}, {4, 7},
+      {2, 3}, {6, 7}, {3, 4}, {5, 6}, {4, 5}};
+  for (const auto &comparator : network) {
+    uint16_t a = keys[comparator[0]];
+    uint16_t b = keys[comparator[1]];
+    keys[comparator[0]] = std::min(a, b);
+    keys[comparator[1]] = std::max(a, b);
+  }
+
+  for (int i = 0; i < selected.count; i++) {
+    uint8_t spIndex = keys[i] & 0xFF;
+    Sprite &sprite = selected.sprites[i];
+    sprite.y = oam[4 * spIndex];
+    sprite.x = oam[4 * spIndex + 1];
+    sprite.tile = oam[4 * spIndex + 2];
+    sprite.attributes = oam[4 * spIndex + 3];
+    sprite.index = spIndex;
+  }
+}
@@ -0,0 +1,159 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include "framebuffer.h"
+#include "tilecache.h"
+
+class Recorder;
+
+constexpr int WIDTH = 160;
+constexpr int HEIGHT = 144;
+
+struct Sprite {
+  uint8_t x;
+  uint8_t y;
+  uint8_t tile;
+  uint8_t attributes;
+  uint8_t index;
+};
+
+struct DMGPalette {
+  const char *name;
+  uint32_t colors[4];
+};
+
+// Shades of the DMG screen, from lightest to darkest, as 0xRRGGBB.
+extern const DMGPalette dmgPalettes[];
+extern const int dmgPaletteCount;
+
+// The sprites selected for one scanline, in drawing priority order.
+struct SpriteLine {
+  Sprite sprites[10];
+  uint8_t count = 0;
+};
+
+// Selects the sprites on line LY from OAM, the first ten in OAM order, sorted
+// into drawing priority order.
+void selectSprites(const uint8_t *oam, uint8_t LY, uint8_t LCDC,
+                   SpriteLine &selected);
+
+// The PPU registers a line is drawn with, as they were when the PPU reached
+// it.
+struct LineRegisters {
+  uint8_t LCDC;
+  uint8_t SCY;
+  uint8_t SCX;
+  uint8_t WY;
+  uint8_t WX;
+  uint8_t BGP;
+  uint8_t OBP0;
+  uint8_t OBP1;
+  uint8_t LY;
+  bool windowEnabled;
+};
+
+// Hashes of a finished frame's shades, so they do not depend on the palette
+// or the pixel format.
+struct FrameHash {
+  // Frames finished before this one, including skipped ones.
+  uint64_t frame;
+  uint64_t hash;
+  // Hashes of every line, only if they were asked for.
+  const uint64_t *lines;
+};
+
+using FrameHashHandler = void (*)(void *context, const FrameHash &hash);
+
+// Draws lines into frames from its own copy of VRAM and OAM, which only
+// changes through write(). That way it can run behind the emulation on
+// another thread and still see memory as it was when each line was drawn.
+class LineRenderer {
+  std::vector<uint8_t> vram;
+  std::vector<uint8_t> oam;
+  TileCache tileCache;
+  SpriteLine lineSprites[HEIGHT];
+  uint8_t WLY = 0;
+
+  // BGP, OBP0 and OBP1 resolved to a shade per color index, and the shades
+  // resolved to output colors. Only rebuilt when the registers or the
+  // selected palette change.
+  uint8_t BGP = 0;
+  uint8_t OBP0 = 0;
+  uint8_t OBP1 = 0;
+  uint8_t backgroundShades[4] = {};
+  uint8_t spriteShades[2][4] = {};
+  uint32_t outputColors[4];
+  std::atomic<int> palette{0};
+  int resolvedPalette = 0;
+
+  PixelFormat pixelFormat = PixelFormat::RGB888;
+  TripleBuffer frames;
+  Recorder *recorder = nullptr;
+
+  FrameHashHandler hashHandler = nullptr;
+  void *hashContext = nullptr;
+  bool hashLines = false;
+  uint64_t finishedFrames = 0;
+  uint64_t frameSequence = 0;
+  std::atomic<int> publishedFrames{0};
+  // Input read in frames that were not presented yet.
+  InputStamp pendingInput;
+
+  // Shades of every line of the last published frame, hashed, and what
+  // changed in the frame being drawn since then.
+  uint64_t lineHashes[HEIGHT] = {};
+  int firstDirtyLine = HEIGHT;
+  int lastDirtyLine = -1;
+  uint64_t changedTiles[TILE_COUNT / 64];
+  bool allLinesDirty = true;
+
+  void updatePaletteTables(const LineRegisters &registers);
+  void resolveColors();
+  uint64_t hashFrame() const;
+
+public:
+  LineRenderer();
+
+  // Takes an address in VRAM or OAM.
+  void write(uint16_t addr, uint8_t value);
+
+  void drawLine(const LineRegisters &registers);
+  // Stores a line of shades that was drawn elsewhere.
+  void storeLine(uint8_t LY, const uint8_t *shades);
+  // Hands the finished frame to the presenting thread, unless it is identical
+  // to the last one or was skipped, and to the recorder. input is the host
+  // input the game read during the frame, it stays with the frames until one
+  // of them is presented.
+  void finishFrame(bool skipped = false, const InputStamp &input = {});
+
+  // Selects one of dmgPalettes, takes effect from the next frame. Can be
+  // called from any thread.
+  void setPalette(int index) { palette = index; }
+  int getPalette() { return palette; }
+
+  // Has to be set before the first line is drawn.
+  void setPixelFormat(PixelFormat format);
+  PixelFormat getPixelFormat() { return pixelFormat; }
+
+  TripleBuffer &getFrames() { return frames; }
+  // Receives every frame, drawn or skipped. Has to be set while no lines are
+  // being drawn.
+  void setRecorder(Recorder *recorder) { this->recorder = recorder; }
+  // Calls handler with the hash of every frame that is drawn, and with the
+  // hashes of its lines if lines is set. Frames are only hashed while a
+  // handler is set. Has to be set while no lines are being drawn.
+  void setFrameHashHandler(void *context, FrameHashHandler handler,
+                           bool lines) {
+    hashContext = context;
+    hashHandler = handler;
+    hashLines = lines;
+  }
+  // Number of frames published since the last call.
+  int takePublishedFrames() { return publishedFrames.exchange(0); }
+
+  // Sprites selected for a line the last time it was drawn.
+  const SpriteLine &getSprites(uint8_t line) { return lineSprites[line]; }
+};
@@ -0,0 +1,73 @@
+#include "pacer.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <thread>
+
+Pacer::Pacer(double framesPerSecond)
+    : period(std::chrono::duration_cast<Clock::duration>(
+          std::chrono::duration<double>(1.0 / framesPerSecond))),
+      deadline(Clock::now()), frameStart(deadline) {}
+
+uint64_t Pacer::frameDone() {
+  Clock::time_point now = Clock::now();
+  Clock::duration work = now - frameStart;
+  if (!throttled) {
+    frameStart = now;
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(work).count();
+  }
+  deadline += period;
+
+  double late = std::chrono::duration<double>(now - deadline) /
+                std::chrono::duration<double>(period);
+  lateness = 0.75 * lateness + 0.25 * std::max(late, 0.0);
+
+  if (late > 4) {
+    // Too far behind (or paused) to catch up, start over from here.
+    deadline = now;
+    oversleep = Clock::duration(0);
+  } else if (late < 0) {
+    std::this_thread::sleep_until(deadline);
+    oversleep = Clock::now() - deadline;
+  } else {
+    oversleep = Clock::duration(0);
+  }
+
+  frameStart = Clock::now();
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(work).count();
+}
+
+bool FrameSkipper::parse(const std::string &spec) {
+  if (spec == "auto") {
+    setting = -1;
+    return true;
+  }
+  char *end;
+  long frames = strtol(spec.c_str(), &end, 10);
+  if (spec.empty() || *end != '\0' || frames < 0 || frames > 9)
+    return false;
+  setting = frames;
+  return true;
+}
+
+bool FrameSkipper::skipNextFrame(const Pacer &pacer) {
+  bool skip;
+  if (setting >= 0)
+    skip = skippedInRow < setting;
+  else
+    skip = skippedInRow < maxAutoSkip && pacer.getLateness() > 0.1;
+
+  if (skip) {
+    skippedInRow++;
+    skippedFrames++;
+  } else {
+    skippedInRow = 0;
+  }
+  return skip;
+}
+
+int FrameSkipper::takeSkippedFrames() {
+  int frames = skippedFrames;
+  skippedFrames = 0;
+  return frames;
+}
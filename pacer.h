@@ -0,0 +1,60 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+// Keeps the emulation at a fixed frame rate. Frames are timed against
+// absolute deadlines, so time overslept in one frame is made up in the
+// next, and how late frames finish is tracked for frame skipping.
+class Pacer {
+  using Clock = std::chrono::steady_clock;
+
+  Clock::duration period;
+  Clock::time_point deadline;
+  Clock::time_point frameStart;
+
+  // How far past their deadline frames finished, in frames, smoothed over
+  // the last few frames.
+  double lateness = 0;
+  Clock::duration oversleep{0};
+  bool throttled = true;
+
+public:
+  Pacer(double framesPerSecond);
+
+  // Called when a frame was emulated. Sleeps until its deadline and returns
+  // the time spent emulating it in nanoseconds.
+  uint64_t frameDone();
+  // Unthrottled, frames are only timed and run as fast as they can.
+  void setThrottled(bool throttled) { this->throttled = throttled; }
+
+  double getLateness() const { return lateness; }
+  // How much longer than asked the last sleep took, in nanoseconds.
+  uint64_t getOversleep() const {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(oversleep)
+        .count();
+  }
+};
+
+// Decides which frames are drawn. Skipped frames are still emulated, only
+// the pixels are not composed.
+class FrameSkipper {
+  // Frames skipped after every drawn one, or -1 to skip while the pacer
+  // reports frames finishing late.
+  int setting = 0;
+  int skippedInRow = 0;
+  int skippedFrames = 0;
+
+  // Automatic mode still draws at least one frame in this many.
+  static constexpr int maxAutoSkip = 3;
+
+public:
+  // Takes a number of frames or "auto".
+  bool parse(const std::string &spec);
+  bool isEnabled() const { return setting != 0; }
+
+  bool skipNextFrame(const Pacer &pacer);
+  // Number of frames skipped since the last call.
+  int takeSkippedFrames();
+};
@@ -0,0 +1,57 @@
+#include "perfstats.h"
+
+#include <algorithm>
+
+namespace {
+
+// 4194304 Hz, the emulation steps 4 clocks at a time.
+constexpr float cyclesPerSecondDMG = 1048576;
+
+float ms(uint64_t nanoseconds) { return nanoseconds / 1'000'000.0f; }
+
+// Only one thread writes each average, so a load and a store will do.
+void smooth(std::atomic<float> &average, float value) {
+  average.store(average.load() * 0.95f + value * 0.05f);
+}
+
+} // namespace
+
+void PerfStats::addFrame(uint64_t work, uint64_t ppu, uint64_t runAhead,
+                         uint64_t oversleep, double lateness) {
+  uint64_t cpu = work > ppu + runAhead ? work - ppu - runAhead : 0;
+  smooth(cpuTime, ms(cpu));
+  smooth(ppuTime, ms(ppu));
+  smooth(runAheadTime, ms(runAhead));
+  this->oversleep = ms(oversleep);
+  this->lateness = lateness;
+
+  uint32_t frame = frames.load(std::memory_order_relaxed);
+  frameTimes[frame % historyFrames].store(ms(work), std::memory_order_relaxed);
+  frames.store(frame + 1, std::memory_order_release);
+}
+
+void PerfStats::addSecond(int cycles, int frames, int changed, int skipped) {
+  cyclesPerSecond = cycles;
+  framesPerSecond = frames;
+  changedPerSecond = changed;
+  skippedPerSecond = skipped;
+}
+
+void PerfStats::addPresent(uint64_t nanoseconds) {
+  smooth(presentTime, ms(nanoseconds));
+}
+
+float PerfStats::getSpeed() const {
+  return cyclesPerSecond / cyclesPerSecondDMG * 100;
+}
+
+float PerfStats::getClock() const { return cyclesPerSecond * 4 / 1e6f; }
+
+int PerfStats::getFrameTimes(float out[historyFrames]) const {
+  uint32_t end = frames.load(std::memory_order_acquire);
+  int count = std::min<uint32_t>(end, historyFrames);
+  for (int i = 0; i < count; i++)
+    out[i] = frameTimes[(end - count + i) % historyFrames].load(
+        std::memory_order_relaxed);
+  return count;
+}
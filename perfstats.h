@@ -0,0 +1,59 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+// Performance numbers of the emulation and the presenter, for the debug UI.
+// Every number has a single writer, anything can read them.
+class PerfStats {
+public:
+  static constexpr int historyFrames = 240;
+
+private:
+  // Time spent on each emulated frame in ms, the last historyFrames of them.
+  std::atomic<float> frameTimes[historyFrames] = {};
+  std::atomic<uint32_t> frames{0};
+
+  // Smoothed over the last few frames, in ms.
+  std::atomic<float> cpuTime{0};
+  std::atomic<float> ppuTime{0};
+  std::atomic<float> runAheadTime{0};
+  std::atomic<float> presentTime{0};
+  std::atomic<float> oversleep{0};
+  std::atomic<float> lateness{0};
+
+  // Over the last second.
+  std::atomic<int> cyclesPerSecond{0};
+  std::atomic<int> framesPerSecond{0};
+  std::atomic<int> changedPerSecond{0};
+  std::atomic<int> skippedPerSecond{0};
+
+public:
+  // Called by the emulation once per frame, times in nanoseconds. work is
+  // everything the frame took, the time outside the PPU and run-ahead is
+  // counted as CPU time.
+  void addFrame(uint64_t work, uint64_t ppu, uint64_t runAhead,
+                uint64_t oversleep, double lateness);
+  // Called by the emulation once per second.
+  void addSecond(int cycles, int frames, int changed, int skipped);
+  // Called by the presenter once per presented frame.
+  void addPresent(uint64_t nanoseconds);
+
+  float getCPUTime() const { return cpuTime; }
+  float getPPUTime() const { return ppuTime; }
+  float getRunAheadTime() const { return runAheadTime; }
+  float getPresentTime() const { return presentTime; }
+  float getOversleep() const { return oversleep; }
+  float getLateness() const { return lateness; }
+
+  int getFramesPerSecond() const { return framesPerSecond; }
+  int getChangedPerSecond() const { return changedPerSecond; }
+  int getSkippedPerSecond() const { return skippedPerSecond; }
+  // Emulated speed, 100 is a real DMG.
+  float getSpeed() const;
+  // Emulated clock in MHz.
+  float getClock() const;
+
+  // Copies the recent frame times, oldest first, returns how many there are.
+  int getFrameTimes(float out[historyFrames]) const;
+};
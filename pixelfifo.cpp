@@ -0,0 +1,178 @@
+#include "pixelfifo.h"
+
+#include <cstring>
+
+PixelFifo::PixelFifo(const uint8_t *vram, const uint8_t *oam)
+    : vram(vram), oam(oam) {}
+
+void PixelFifo::startLine(const LineRegisters &registers) {
+  selectSprites(oam, registers.LY, registers.LCDC, sprites);
+  nextSprite = 0;
+  spriteDots = 0;
+
+  backgroundCount = 0;
+  memset(spriteColors, 0, sizeof(spriteColors));
+  memset(spriteAttributes, 0, sizeof(spriteAttributes));
+
+  step = FetchStep::Tile;
+  stepDots = 0;
+  fetcherX = 0;
+  fetchingWindow = false;
+
+  // The first tile is fetched twice, and the pixels scrolled out by the fine
+  // SCX are shifted out without reaching the LCD.
+  delay = 6;
+  discard = registers.SCX % 8;
+  lcdX = 0;
+}
+
+bool PixelFifo::tick(const LineRegisters &registers) {
+  if (delay > 0) {
+    delay--;
+    return false;
+  }
+
+  // A sprite starting at this pixel stops the pixels going out until the
+  // background fetcher finished its current tile and the sprite was fetched.
+  if (nextSprite < sprites.count && (registers.LCDC & (1 << 1)) &&
+      sprites.sprites[nextSprite].x <= lcdX + 8) {
+    if (step != FetchStep::Push) {
+      fetch(registers);
+    } else if (++spriteDots == 6) {
+      spriteDots = 0;
+      fetchSprite(registers);
+      nextSprite++;
+    }
+    return false;
+  }
+
+  if (!fetchingWindow && discard == 0 && windowStarts(registers)) {
+    fetchingWindow = true;
+    backgroundCount = 0;
+    fetcherX = 0;
+    step = FetchStep::Tile;
+    stepDots = 0;
+    // With WX below 7 the window starts left of the screen.
+    if (lcdX + 7 > registers.WX)
+      discard = lcdX + 7 - registers.WX;
+  }
+
+  fetch(registers);
+  if (backgroundCount == 0)
+    return false;
+
+  uint8_t color = background[8 - backgroundCount--];
+  if (discard > 0) {
+    discard--;
+    return false;
+  }
+
+  uint8_t spriteColor = spriteColors[0];
+  uint8_t attributes = spriteAttributes[0];
+  memmove(spriteColors, spriteColors + 1, 7);
+  memmove(spriteAttributes, spriteAttributes + 1, 7);
+  spriteColors[7] = 0;
+
+  if (!(registers.LCDC & 1))
+    color = 0;
+  uint8_t shade = (registers.BGP >> (2 * color)) & 0x3;
+  bool behindBackground = (attributes & 0x80) && color != 0;
+  if (spriteColor != 0 && (registers.LCDC & (1 << 1)) && !behindBackground) {
+    uint8_t palette = attributes & 0x10 ? registers.OBP1 : registers.OBP0;
+    shade = (palette >> (2 * spriteColor)) & 0x3;
+  }
+  shades[lcdX++] = shade;
+
+  if (lcdX < WIDTH)
+    return false;
+  if (fetchingWindow)
+    windowLine++;
+  return true;
+}
+
+bool PixelFifo::windowStarts(const LineRegisters &registers) {
+  if (!(registers.LCDC & (1 << 5)) || !registers.windowEnabled)
+    return false;
+  if (registers.WX > 166 || registers.WY > 143 || registers.LY < registers.WY)
+    return false;
+  return lcdX + 7 >= registers.WX;
+}
+
+void PixelFifo::fetch(const LineRegisters &registers) {
+  if (step == FetchStep::Push) {
+    if (backgroundCount > 0)
+      return;
+    for (int x = 0; x < 8; x++)
+      background[x] =
+          ((dataLow >> (7 - x)) & 1) | (((dataHigh >> (7 - x)) & 1) << 1);
+    backgroundCount = 8;
+    fetcherX++;
+    step = FetchStep::Tile;
+    return;
+  }
+
+  // Every other step takes two dots, memory is read on the second one.
+  if (++stepDots < 2)
+    return;
+  stepDots = 0;
+
+  switch (step) {
+  case FetchStep::Tile: {
+    uint16_t tileMap;
+    uint8_t column, row;
+    if (fetchingWindow) {
+      tileMap = registers.LCDC & (1 << 6) ? 0x1C00 : 0x1800;
+      column = fetcherX;
+      row = windowLine;
+    } else {
+      tileMap = registers.LCDC & (1 << 3) ? 0x1C00 : 0x1800;
+      column = registers.SCX / 8 + fetcherX;
+      row = registers.LY + registers.SCY;
+    }
+    tile = vram[tileMap + (row / 8) * 32 + column % 32];
+    step = FetchStep::DataLow;
+    break;
+  }
+  case FetchStep::DataLow:
+    dataLow = vram[tileRowAddress(registers)];
+    step = FetchStep::DataHigh;
+    break;
+  case FetchStep::DataHigh:
+    dataHigh = vram[tileRowAddress(registers) + 1];
+    step = FetchStep::Push;
+    break;
+  case FetchStep::Push:
+    break;
+  }
+}
+
+uint16_t PixelFifo::tileRowAddress(const LineRegisters &registers) {
+  uint8_t y = fetchingWindow ? windowLine : registers.LY + registers.SCY;
+  bool signedTileIndex = (registers.LCDC & (1 << 4)) == 0;
+  return 16 * TileCache::index(tile, signedTileIndex) + 2 * (y % 8);
+}
+
+void PixelFifo::fetchSprite(const LineRegisters &registers) {
+  const Sprite &sprite = sprites.sprites[nextSprite];
+  uint8_t height = registers.LCDC & (1 << 2) ? 16 : 8;
+  uint8_t y = registers.LY - (sprite.y - 16);
+  if (sprite.attributes & 0x40)
+    y = height - 1 - y;
+  uint8_t spriteTile = height == 16 ? sprite.tile & 0xFE : sprite.tile;
+  uint16_t addr = 16 * spriteTile + 2 * y;
+  uint8_t low = vram[addr];
+  uint8_t high = vram[addr + 1];
+
+  // Sprites partly left of the screen start with some of their pixels
+  // already gone. Pixels already in the FIFO belong to sprites with a
+  // higher priority and are only replaced where they are transparent.
+  int skip = lcdX - (sprite.x - 8);
+  for (int i = skip; i < 8; i++) {
+    int bit = sprite.attributes & 0x20 ? i : 7 - i;
+    uint8_t color = ((low >> bit) & 1) | (((high >> bit) & 1) << 1);
+    if (color != 0 && spriteColors[i - skip] == 0) {
+      spriteColors[i - skip] = color;
+      spriteAttributes[i - skip] = sprite.attributes;
+    }
+  }
+}
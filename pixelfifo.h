@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstdint>
+
+#include "linerenderer.h"
+
+// Draws a line one dot at a time the way the DMG does it. A background
+// fetcher reads a tile row every 8 dots into a FIFO that is shifted out to
+// the LCD one pixel per dot, and sprites are fetched into a second FIFO
+// that is mixed in as the pixels go out, stalling the background while
+// they are fetched.
+//
+// Mode 3 therefore takes as long as it does on hardware (longer with a fine
+// SCX, sprites and the window) and registers are read at the dot the
+// hardware reads them, so changes in the middle of a line show up.
+class PixelFifo {
+  enum class FetchStep : uint8_t { Tile, DataLow, DataHigh, Push };
+
+  const uint8_t *vram;
+  const uint8_t *oam;
+
+  SpriteLine sprites;
+  int nextSprite = 0;
+  int spriteDots = 0;
+
+  // The fetcher only refills the background FIFO once it is empty, so it
+  // never holds more than one tile row.
+  uint8_t background[8];
+  int backgroundCount = 0;
+  // Sprite pixels lined up with the next pixels to be shifted out.
+  uint8_t spriteColors[8];
+  uint8_t spriteAttributes[8];
+
+  FetchStep step = FetchStep::Tile;
+  int stepDots = 0;
+  uint8_t fetcherX = 0;
+  uint8_t tile = 0;
+  uint8_t dataLow = 0;
+  uint8_t dataHigh = 0;
+  bool fetchingWindow = false;
+
+  int delay = 0;
+  int discard = 0;
+  uint8_t lcdX = 0;
+  uint8_t windowLine = 0;
+  uint8_t shades[WIDTH];
+
+  void fetch(const LineRegisters &registers);
+  uint16_t tileRowAddress(const LineRegisters &registers);
+  void fetchSprite(const LineRegisters &registers);
+  bool windowStarts(const LineRegisters &registers);
+
+public:
+  PixelFifo(const uint8_t *vram, const uint8_t *oam);
+
+  // Called at the end of OAM scan.
+  void startLine(const LineRegisters &registers);
+  // Runs one dot of mode 3 with the registers as they are now. Returns true
+  // once the last pixel of the line was shifted out.
+  bool tick(const LineRegisters &registers);
+  void startFrame() { windowLine = 0; }
+
+  const uint8_t *getShades() { return shades; }
+};
@@ -6,8 +6,11 @@
 #include <GLFW/glfw3.h>
 #include <imgui/imgui.h>
 
+#include <algorithm>
 #include <bits/stdint-uintn.h>
+#include <cfloat>
 #include <chrono>
+#include <cmath>
 #include <cstring>
 #include <iostream>
 #include <iterator>
@@ -17,17 +20,6 @@
 
 constexpr uint8_t interruptVblank = 1 << 0;
 constexpr uint8_t interruptLCDC = 1 << 1;
-constexpr uint8_t interruptInput = 1 << 4;
-
-struct Sprite {
-  uint8_t x;
-  uint8_t y;
-  uint8_t tile;
-  uint8_t attributes;
-
-  Sprite(uint8_t x, uint8_t y, uint8_t tile, uint8_t attributes)
-      : x(x), y(y), tile(tile), attributes(attributes) {}
-};
 
 void error_callback(int error, const char *description) {
   fprintf(stderr, "ERROR(%i): %s\n", error, description);
@@ -40,42 +32,26 @@ void key_callback(GLFWwindow *window, int key, int scancode, int action,
   // printf("K: %i, S: %i, Minus: %i", key, scancode,
   //        glfwGetKeyScancode(GLFW_KEY_MINUS));
 
+  // Keys are matched by position, so the layout does not matter.
+  static const struct {
+    int key;
+    Button button;
+  } keymap[] = {
+      {GLFW_KEY_DOWN, Button::Down},     {GLFW_KEY_UP, Button::Up},
+      {GLFW_KEY_LEFT, Button::Left},     {GLFW_KEY_RIGHT, Button::Right},
+      {GLFW_KEY_ESCAPE, Button::Start},  {GLFW_KEY_BACKSPACE, Button::Select},
+      {GLFW_KEY_X, Button::A},           {GLFW_KEY_Z, Button::B},
+  };
   bool set = action == GLFW_PRESS || action == GLFW_REPEAT;
-  bool changed = false;
-  if (scancode == glfwGetKeyScancode(GLFW_KEY_DOWN)) {
-    changed = instance->joypadDown ^ set;
-    instance->joypadDown = set;
-  }
-  if (scancode == glfwGetKeyScancode(GLFW_KEY_UP)) {
-    changed = instance->joypadUp ^ set;
-    instance->joypadUp = set;
-  }
-  if (scancode == glfwGetKeyScancode(GLFW_KEY_LEFT)) {
-    changed = instance->joypadLeft ^ set;
-    instance->joypadLeft = set;
-  }
-  if (scancode == glfwGetKeyScancode(GLFW_KEY_RIGHT)) {
-    changed = instance->joypadRight ^ set;
-    instance->joypadRight = set;
-  }
-  if (scancode == glfwGetKeyScancode(GLFW_KEY_ESCAPE)) {
-    changed = instance->joypadStart ^ set;
-    instance->joypadStart = set;
-  }
-  if (scancode == glfwGetKeyScancode(GLFW_KEY_BACKSPACE)) {
-    changed = instance->joypadSelect ^ set;
-    instance->joypadSelect = set;
-  }
-  if (scancode == glfwGetKeyScancode(GLFW_KEY_X)) {
-    changed = instance->joypadA ^ set;
-    instance->joypadA = set;
-  }
-  if (scancode == glfwGetKeyScancode(GLFW_KEY_Z)) {
-    changed = instance->joypadB ^ set;
-    instance->joypadB = set;
-  }
-  if (changed)
-    instance->raiseInterrupt(interruptInput);
+  for (const auto &mapping : keymap)
+    if (scancode == glfwGetKeyScancode(mapping.key))
+      instance->getJoypad().press(mapping.button, set);
+  if (key == GLFW_KEY_F1 && action == GLFW_PRESS)
+    instance->toggleDebugUI();
+  if (key == GLFW_KEY_F2 && action == GLFW_PRESS)
+    instance->toggleEngine();
+  if (key == GLFW_KEY_F5 && action == GLFW_PRESS)
+    instance->requestResume();
 }
 
 std::string vertexShaderSource = R"EOF(
@@ -99,10 +75,15 @@ out vec4 FragColor;
 in vec2 fTexCoords;
 
 uniform sampler2D uTexture;
+uniform bool uIndexed;
+uniform vec3 uPalette[4];
 
 void main()
 {
-	FragColor = texture(uTexture, fTexCoords);
+	if (uIndexed)
+		FragColor = vec4(uPalette[int(texture(uTexture, fTexCoords).r * 255.0 + 0.5)], 1.0);
+	else
+		FragColor = texture(uTexture, fTexCoords);
 }
 )EOF";
 
@@ -113,107 +94,389 @@ constexpr float vertices[] = {
 };
 
 PPU::PPU(Bus *bus)
-    : bus(bus), vram(0x2000), oam(0xA0), hasSetUp(false), hasClosed(false),
-      frame(0), LY(0), LX(0), LYC(0), LCDC(0), BGP(0), WY(0), WX(0) {}
+    : bus(bus), vram(0x2000), oam(0xA0), fifo(vram.data(), oam.data()),
+      frame(0), LY(0), LX(0), LYC(0), LCDC(0), BGP(0), WY(0), WX(0) {
+  connectIO(bus->getIO());
+  renderer.getFrames().setPublishHandler(
+      this, [](void *ppu) { static_cast<PPU *>(ppu)->wakeWindow(); });
+}
 
 void PPU::raiseInterrupt(uint8_t interrupt) { bus->raiseInterrupt(interrupt); }
 
+void PPU::connectIO(IORegisters &io) {
+  io.connect(
+      0xFF40, this,
+      [](void *ppu, uint16_t addr) -> uint8_t {
+        return static_cast<PPU *>(ppu)->LCDC;
+      },
+      [](void *ppu, uint16_t addr, uint8_t value) {
+        PPU *instance = static_cast<PPU *>(ppu);
+        instance->catchUp();
+        instance->LCDC = value;
+        // Turning the LCD on or off changes how long cycles can be deferred.
+        instance->catchUp();
+      });
+  io.connect(
+      0xFF41, this,
+      [](void *ppu, uint16_t addr) -> uint8_t {
+        static_cast<PPU *>(ppu)->catchUp();
+        return static_cast<PPU *>(ppu)->STAT;
+      },
+      [](void *ppu, uint16_t addr, uint8_t value) {
+        PPU *instance = static_cast<PPU *>(ppu);
+        instance->catchUp();
+        uint8_t writeMask = 0b11111000;
+        value &= writeMask;
+        instance->STAT &= ~writeMask;
+        instance->STAT |= value;
+      });
+  io.connect(
+      0xFF42, this,
+      [](void *ppu, uint16_t addr) -> uint8_t {
+        return static_cast<PPU *>(ppu)->SCY;
+      },
+      [](void *ppu, uint16_t addr, uint8_t value) {
+        static_cast<PPU *>(ppu)->catchUp();
+        static_cast<PPU *>(ppu)->SCY = value;
+      });
+  io.connect(
+      0xFF43, this,
+      [](void *ppu, uint16_t addr) -> uint8_t {
+        return static_cast<PPU *>(ppu)->SCX;
+      },
+      [](void *ppu, uint16_t addr, uint8_t value) {
+        static_cast<PPU *>(ppu)->catchUp();
+        static_cast<PPU *>(ppu)->SCX = value;
+      });
+  io.connect(
+      0xFF44, this,
+      [](void *ppu, uint16_t addr) -> uint8_t {
+        static_cast<PPU *>(ppu)->catchUp();
+        return static_cast<PPU *>(ppu)->LY;
+      },
+      [](void *ppu, uint16_t addr, uint8_t value) {
+        static_cast<PPU *>(ppu)->catchUp();
+        static_cast<PPU *>(ppu)->LY = 0;
+      });
+  io.connect(
+      0xFF45, this,
+      [](void *ppu, uint16_t addr) -> uint8_t {
+        return static_cast<PPU *>(ppu)->LYC;
+      },
+      [](void *ppu, uint16_t addr, uint8_t value) {
+        static_cast<PPU *>(ppu)->catchUp();
+        static_cast<PPU *>(ppu)->LYC = value;
+      });
+  io.connect(
+      0xFF47, this,
+      [](void *ppu, uint16_t addr) -> uint8_t {
+        return static_cast<PPU *>(ppu)->BGP;
+      },
+      [](void *ppu, uint16_t addr, uint8_t value) {
+        static_cast<PPU *>(ppu)->catchUp();
+        static_cast<PPU *>(ppu)->BGP = value;
+      });
+  io.connect(
+      0xFF48, this,
+      [](void *ppu, uint16_t addr) -> uint8_t {
+        return static_cast<PPU *>(ppu)->OBP0;
+      },
+      [](void *ppu, uint16_t addr, uint8_t value) {
+        static_cast<PPU *>(ppu)->catchUp();
+        static_cast<PPU *>(ppu)->OBP0 = value;
+      });
+  io.connect(
+      0xFF49, this,
+      [](void *ppu, uint16_t addr) -> uint8_t {
+        return static_cast<PPU *>(ppu)->OBP1;
+      },
+      [](void *ppu, uint16_t addr, uint8_t value) {
+        static_cast<PPU *>(ppu)->catchUp();
+        static_cast<PPU *>(ppu)->OBP1 = value;
+      });
+  io.connect(
+      0xFF4A, this,
+      [](void *ppu, uint16_t addr) -> uint8_t {
+        return static_cast<PPU *>(ppu)->WY;
+      },
+      [](void *ppu, uint16_t addr, uint8_t value) {
+        PPU *instance = static_cast<PPU *>(ppu);
+        instance->catchUp();
+        instance->WY = value;
+        // The next cycle compares WY with LY, but it may only advance LX.
+        bool isLCDOn = instance->LCDC & (1 << 7);
+        if (isLCDOn && instance->LY < 144 && value == instance->LY)
+          instance->windowEnabled = true;
+      });
+  io.connect(
+      0xFF4B, this,
+      [](void *ppu, uint16_t addr) -> uint8_t {
+        return static_cast<PPU *>(ppu)->WX;
+      },
+      [](void *ppu, uint16_t addr, uint8_t value) {
+        static_cast<PPU *>(ppu)->catchUp();
+        static_cast<PPU *>(ppu)->WX = value;
+      });
+}
+
 uint8_t PPU::read(uint16_t addr) {
   if (addr >= 0x8000 && addr < 0xA000) {
     return vram[addr - 0x8000];
   } else if (addr >= 0xFE00 && addr < 0xFEA0) {
     return oam[addr - 0xFE00];
-  } else if (addr >= 0xFF00 && addr < 0xFF4C) {
-    if (addr == 0xFF00) {
-      uint8_t value = inputMask | 0b1111;
-      if (!(inputMask & 0b00100000)) {
-        if (joypadStart)
-          value &= ~0b1000;
-        if (joypadSelect)
-          value &= ~0b100;
-        if (joypadB)
-          value &= ~0b10;
-        if (joypadA)
-          value &= ~0b1;
-      }
-      if (!(inputMask & 0b00010000)) {
-        if (joypadDown)
-          value &= ~0b1000;
-        if (joypadUp)
-          value &= ~0b100;
-        if (joypadLeft)
-          value &= ~0b10;
-        if (joypadRight)
-          value &= ~0b1;
-      }
-      // printf("Input read: %02X\n", value);
-      return value;
-    }
-    if (addr == 0xFF40)
-      return LCDC;
-    if (addr == 0xFF41)
-      return STAT;
-    if (addr == 0xFF42)
-      return SCY;
-    if (addr == 0xFF43)
-      return SCX;
-    if (addr == 0xFF44)
-      return LY;
-    if (addr == 0xFF45)
-      return LYC;
-    if (addr == 0xFF47)
-      return BGP;
-  }
-
-  fprintf(stderr, "PPU read at bad address: %04X\n", addr);
+  }
+
+  bus->getCounters().count(AccessClass::BadPPURead, addr);
   return 0xFF;
 }
 
 void PPU::write(uint16_t addr, uint8_t value) {
+  // Lines that are still to be drawn have to see the old contents.
+  catchUp();
   if (addr >= 0x8000 && addr < 0xA000) {
     vram[addr - 0x8000] = value;
   } else if (addr >= 0xFE00 && addr < 0xFEA0) {
     oam[addr - 0xFE00] = value;
-  } else if (addr >= 0xFF00 && addr < 0xFF4C) {
-    if (addr == 0xFF00) {
-      uint8_t writeMask = 0b00110000;
-      value &= writeMask;
-      inputMask &= ~writeMask;
-      inputMask |= value;
+  } else {
+    bus->getCounters().count(AccessClass::BadPPUWrite, addr);
+    return;
+  }
+  forwardWrite(addr, value);
+}
+
+void PPU::saveState(State &state) {
+  catchUp();
+  state.LCDC = LCDC;
+  state.STAT = STAT;
+  state.BGP = BGP;
+  state.OBP0 = OBP0;
+  state.OBP1 = OBP1;
+  state.SCY = SCY;
+  state.SCX = SCX;
+  state.LYC = LYC;
+  state.LY = LY;
+  state.LX = LX;
+  state.WY = WY;
+  state.WX = WX;
+  state.windowEnabled = windowEnabled;
+  state.vram = vram;
+  state.oam = oam;
+  state.engine = engine;
+  state.fifo = fifo;
+  state.fifoLineDone = fifoLineDone;
+  state.skippingFrame = skippingFrame;
+  state.hidingFrame = hidingFrame;
+  state.deferrableCycles = deferrableCycles;
+}
+
+void PPU::loadState(const State &state) {
+  LCDC = state.LCDC;
+  STAT = state.STAT;
+  BGP = state.BGP;
+  OBP0 = state.OBP0;
+  OBP1 = state.OBP1;
+  SCY = state.SCY;
+  SCX = state.SCX;
+  LYC = state.LYC;
+  LY = state.LY;
+  LX = state.LX;
+  WY = state.WY;
+  WX = state.WX;
+  windowEnabled = state.windowEnabled;
+
+  // Usually only a few bytes changed since the state was saved.
+  for (uint16_t i = 0; i < vram.size(); i++) {
+    if (vram[i] != state.vram[i]) {
+      vram[i] = state.vram[i];
+      forwardWrite(0x8000 + i, vram[i]);
     }
-    if (addr == 0xFF40)
-      LCDC = value;
-    if (addr == 0xFF41) {
-      uint8_t writeMask = 0b11111000;
-      value &= writeMask;
-      STAT &= ~writeMask;
-      STAT |= value;
+  }
+  for (uint16_t i = 0; i < oam.size(); i++) {
+    if (oam[i] != state.oam[i]) {
+      oam[i] = state.oam[i];
+      forwardWrite(0xFE00 + i, oam[i]);
     }
-    if (addr == 0xFF42)
-      SCY = value;
-    if (addr == 0xFF43)
-      SCX = value;
-    if (addr == 0xFF44)
-      LY = 0;
-    if (addr == 0xFF45)
-      LYC = value;
-    if (addr == 0xFF47)
-      BGP = value;
-    if (addr == 0xFF48)
-      OBP0 = value;
-    if (addr == 0xFF49)
-      OBP1 = value;
-    if (addr == 0xFF4A)
-      WY = value;
-    if (addr == 0xFF4B)
-      WX = value;
-  } else
-    fprintf(stderr, "PPU Written at bad address: %04X\n", addr);
-}
-
-void PPU::invalidate() { invalidated = true; }
-
-void PPU::close() { hasClosed = true; }
+  }
+
+  if (engine != state.engine) {
+    engine = state.engine;
+    updateWorker();
+  }
+  // The copy points at this PPU's memory like the original did.
+  fifo = state.fifo;
+  fifoLineDone = state.fifoLineDone;
+  skippingFrame = state.skippingFrame;
+  hidingFrame = state.hidingFrame;
+  pendingCycles = 0;
+  deferrableCycles = state.deferrableCycles;
+}
+
+LineRegisters PPU::lineRegisters() {
+  return {LCDC, SCY, SCX, WY, WX, BGP, OBP0, OBP1, LY, windowEnabled != 0};
+}
+
+void PPU::setRenderWorker(bool enabled) {
+  useWorker = enabled;
+  updateWorker();
+}
+
+void PPU::setRecorder(Recorder *recorder) {
+  // Lines the worker has not drawn yet are finished before switching.
+  worker.reset();
+  renderer.setRecorder(recorder);
+  updateWorker();
+}
+
+void PPU::setFrameHashHandler(void *context, FrameHashHandler handler,
+                              bool lines) {
+  worker.reset();
+  renderer.setFrameHashHandler(context, handler, lines);
+  updateWorker();
+}
+
+void PPU::updateWorker() {
+  // The FIFO engine reads registers and VRAM as the emulation changes them,
+  // so it always runs inline.
+  bool enabled = useWorker && engine == PPUEngine::Scanline;
+  if (enabled && !worker)
+    worker = std::make_unique<RenderWorker>(renderer);
+  else if (!enabled)
+    worker.reset();
+}
+
+bool PPU::stepFifo() {
+  if (LX == 20) {
+    fifo.startLine(lineRegisters());
+    fifoLineDone = false;
+  }
+  for (int dot = 0; dot < 4 && !fifoLineDone; dot++) {
+    // Skipped frames still run the FIFO, it decides how long mode 3 is.
+    fifoLineDone = fifo.tick(lineRegisters());
+    if (fifoLineDone && !skippingFrame)
+      renderer.storeLine(LY, fifo.getShades());
+  }
+  return fifoLineDone;
+}
+
+const char *ppuEngineName(PPUEngine engine) {
+  switch (engine) {
+  case PPUEngine::Scanline:
+    return "scanline";
+  case PPUEngine::Fifo:
+    return "fifo";
+  }
+  return "unknown";
+}
+
+bool parsePPUEngine(const std::string &name, PPUEngine &engine) {
+  for (PPUEngine candidate : {PPUEngine::Scanline, PPUEngine::Fifo}) {
+    if (name == ppuEngineName(candidate)) {
+      engine = candidate;
+      return true;
+    }
+  }
+  return false;
+}
+
+// Cartridge titles, as in the header, of games that change PPU registers in
+// the middle of a line.
+static const char *const fifoTitles[] = {
+    "PREHISTORIK MAN",
+};
+
+PPUEngine engineForTitle(const std::string &title) {
+  for (const char *fifoTitle : fifoTitles)
+    if (title == fifoTitle)
+      return PPUEngine::Fifo;
+  return PPUEngine::Scanline;
+}
+
+bool PPU::setPalette(const std::string &name) {
+  for (int i = 0; i < dmgPaletteCount; i++) {
+    if (name == dmgPalettes[i].name) {
+      setPalette(i);
+      return true;
+    }
+  }
+  return false;
+}
+
+void PPU::textureFormat(GLenum &format, GLenum &type) {
+  switch (getPixelFormat()) {
+  case PixelFormat::RGB888:
+    format = GL_RGB;
+    type = GL_UNSIGNED_BYTE;
+    break;
+  case PixelFormat::RGBA8888:
+    format = GL_RGBA;
+    type = GL_UNSIGNED_BYTE;
+    break;
+  case PixelFormat::RGB565:
+    format = GL_RGB;
+    type = GL_UNSIGNED_SHORT_5_6_5;
+    break;
+  case PixelFormat::Indexed:
+    format = GL_RED;
+    type = GL_UNSIGNED_BYTE;
+    break;
+  }
+}
+
+void PPU::skipBoot() {
+  LCDC = 0x91;
+  STAT = 0x80;
+  SCY = 0;
+  SCX = 0;
+  LY = 0;
+  LX = 0;
+  LYC = 0;
+  BGP = 0xFC;
+  OBP0 = 0xFF;
+  OBP1 = 0xFF;
+  WY = 0;
+  WX = 0;
+
+  // VRAM as the boot ROM leaves it, written through write() so that it
+  // reaches the renderer.
+  std::vector<uint8_t> image(vram.size(), 0);
+
+  // The boot ROM scales the 48 byte logo at 0x0104 up by two: every nibble
+  // becomes two rows of one tile, with every bit doubled horizontally.
+  uint16_t addr = 0x0010;
+  for (int i = 0; i < 48; i++) {
+    uint8_t logo = bus->read(0x0104 + i);
+    for (int nibble = 0; nibble < 2; nibble++) {
+      uint8_t bits = nibble == 0 ? logo >> 4 : logo & 0xF;
+      uint8_t row = 0;
+      for (int b = 3; b >= 0; b--)
+        row = (row << 2) | (((bits >> b) & 1) * 0b11);
+      image[addr] = row;
+      image[addr + 2] = row;
+      addr += 4;
+    }
+  }
+
+  // Followed by the (R) symbol, stored in the boot ROM itself.
+  constexpr uint8_t registered[] = {0x3C, 0x42, 0xB9, 0xA5,
+                                    0xB9, 0xA5, 0x42, 0x3C};
+  for (uint8_t row : registered) {
+    image[addr] = row;
+    addr += 2;
+  }
+
+  image[0x1910] = 0x19;
+  for (int i = 0; i < 12; i++) {
+    image[0x1904 + i] = 0x01 + i;
+    image[0x1924 + i] = 0x0D + i;
+  }
+  for (uint16_t i = 0; i < image.size(); i++)
+    write(0x8000 + i, image[i]);
+}
+
+void PPU::close() {
+  hasClosed = true;
+  wakeWindow();
+}
 
 bool PPU::isClosed() { return hasClosed; }
 
@@ -221,7 +484,7 @@ void PPU::setup() {
   glfwSetErrorCallback(error_callback);
 
   if (!glfwInit()) {
-    std::cout << "ERROR: Could not initialize GLFW" << std::endl;
+    std::cerr << "ERROR: Could not initialize GLFW" << std::endl;
     glfwTerminate();
     exit(1);
   }
@@ -233,7 +496,7 @@ void PPU::setup() {
   window = glfwCreateWindow(WIDTH * SCALE, HEIGHT * SCALE, "Gameboy Emulator",
                             NULL, NULL);
   if (!window) {
-    std::cout << "ERROR: Could not initialize GLFW" << std::endl;
+    std::cerr << "ERROR: Could not initialize GLFW" << std::endl;
     glfwTerminate();
     exit(1);
   }
@@ -243,7 +506,7 @@ void PPU::setup() {
   glfwMakeContextCurrent(window);
 
   if (glewInit() != GLEW_OK) {
-    std::cout << "ERROR: Could not initialize GLEW" << std::endl;
+    std::cerr << "ERROR: Could not initialize GLEW" << std::endl;
     glfwTerminate();
     exit(1);
   }
@@ -267,17 +530,11 @@ void PPU::setup() {
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, 16 * 8, 12 * 8, 0, GL_RGB,
-               GL_UNSIGNED_BYTE, 0);
+  tileMapPixels.assign(tileMapWidth * tileMapHeight * 3, 0);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, tileMapWidth, tileMapHeight, 0,
+               GL_RGB, GL_UNSIGNED_BYTE, tileMapPixels.data());
   glBindTexture(GL_TEXTURE_2D, 0);
 
-  glGenBuffers(1, &tileMapPBO);
-  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, tileMapPBO);
-
-  glBufferData(GL_PIXEL_UNPACK_BUFFER, tileMapWidth * tileMapHeight * 3, 0,
-               GL_DYNAMIC_DRAW);
-  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
-
   unsigned int vertexShader = glCreateShader(GL_VERTEX_SHADER);
   const GLchar *vertexSource = vertexShaderSource.c_str();
   glShaderSource(vertexShader, 1, &vertexSource, NULL);
@@ -288,7 +545,7 @@ void PPU::setup() {
   glGetShaderiv(vertexShader, GL_COMPILE_STATUS, &success);
   if (!success) {
     glGetShaderInfoLog(vertexShader, 512, NULL, infoLog);
-    std::cout << "ERROR::SHADER::VERTEX::COMPILATION_FAILED\n"
+    std::cerr << "ERROR::SHADER::VERTEX::COMPILATION_FAILED\n"
               << infoLog << std::endl;
     exit(1);
   }
@@ -302,7 +559,7 @@ void PPU::setup() {
   glGetShaderiv(vertexShader, GL_COMPILE_STATUS, &success);
   if (!success) {
     glGetShaderInfoLog(vertexShader, 512, NULL, infoLog);
-    std::cout << "ERROR::SHADER::VERTEX::COMPILATION_FAILED\n"
+    std::cerr << "ERROR::SHADER::VERTEX::COMPILATION_FAILED\n"
               << infoLog << std::endl;
     exit(1);
   }
@@ -315,7 +572,7 @@ void PPU::setup() {
   glGetProgramiv(shaderProgram, GL_LINK_STATUS, &success);
   if (!success) {
     glGetProgramInfoLog(shaderProgram, 512, NULL, infoLog);
-    std::cout << "ERROR::SHADER::VERTEX::COMPILATION_FAILED\n"
+    std::cerr << "ERROR::SHADER::VERTEX::COMPILATION_FAILED\n"
               << infoLog << std::endl;
     exit(1);
   }
@@ -323,6 +580,9 @@ void PPU::setup() {
   glDeleteShader(vertexShader);
   glDeleteShader(fragmentShader);
 
+  indexedUniform = glGetUniformLocation(shaderProgram, "uIndexed");
+  paletteUniform = glGetUniformLocation(shaderProgram, "uPalette");
+
   glGenTextures(1, &screenTexture);
   glBindTexture(GL_TEXTURE_2D, screenTexture);
 
@@ -332,8 +592,9 @@ void PPU::setup() {
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, WIDTH, HEIGHT, 0, GL_RGB,
-               GL_UNSIGNED_BYTE, 0);
+  GLenum format, type;
+  textureFormat(format, type);
+  glTexImage2D(GL_TEXTURE_2D, 0, format, WIDTH, HEIGHT, 0, format, type, 0);
 
   glGenVertexArrays(1, &vao);
   glGenBuffers(1, &vbo);
@@ -352,42 +613,92 @@ void PPU::setup() {
   glBindBuffer(GL_ARRAY_BUFFER, 0);
   glBindVertexArray(0);
 
-  glGenBuffers(1, &pbo);
-  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
-
-  glBufferData(GL_PIXEL_UNPACK_BUFFER, WIDTH * HEIGHT * BYTES_PER_PIXEL, 0,
-               GL_DYNAMIC_DRAW);
-
   glViewport(0, 0, WIDTH * SCALE, HEIGHT * SCALE);
 
-  textureData = (GLubyte *)glMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
-  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
-  pixels = new uint8_t[WIDTH * HEIGHT * BYTES_PER_PIXEL];
-
   glfwSetWindowUserPointer(window, this);
   glfwSetKeyCallback(window, key_callback);
 
   glfwSwapInterval(1);
 
-  printf("Finished setup\n");
-  hasSetUp = true;
+  {
+    std::lock_guard<std::mutex> lock(windowMtx);
+    windowOpen = true;
+  }
+
+  fprintf(stderr, "Finished setup\n");
 }
 
-void PPU::step() {
-  internalLX++;
-  if (internalLX == 4) {
-    internalLX = 0;
-    internalLY++;
-    if (internalLY == 4)
-      internalLX = internalLY = 0;
+void PPU::catchUp() {
+  if (catchingUp)
+    return;
+  catchingUp = true;
+
+  // LX and LY stand still while the LCD is off.
+  bool isLCDOn = LCDC & (1 << 7);
+  if (!isLCDOn)
+    pendingCycles = 0;
+
+  uint64_t start = 0;
+  if (pendingCycles > 0 && ++catchUps % catchUpSampling == 0)
+    start = hostTime();
+  while (pendingCycles > 0) {
+    uint32_t idle =
+        deferCycles ? std::min(pendingCycles, idleCyclesAhead()) : 0;
+    LX += idle;
+    pendingCycles -= idle;
+    if (pendingCycles > 0) {
+      pendingCycles--;
+      tick();
+    }
   }
+  if (start)
+    emulationTime += (hostTime() - start) * catchUpSampling;
 
-  if (!hasSetUp)
-    return;
+  if (!isLCDOn)
+    deferrableCycles = UINT32_MAX;
+  else if (!deferCycles)
+    deferrableCycles = 0;
+  else
+    deferrableCycles = LX == 0 ? 0 : 114 - LX;
+  catchingUp = false;
+
+  // Cheats write through the CPU, which can land in the PPU again.
+  if (vblankStarted) {
+    vblankStarted = false;
+    bus->onVBlank();
+  }
+}
+
+// Number of cycles from LX on that would do nothing but advance LX, leaving
+// STAT as the last cycle that did something set it.
+uint32_t PPU::idleCyclesAhead() {
+  if (LX == 0 || LX >= 113)
+    return 0;
+  if (LY >= 144)
+    return 113 - LX;
+  if (LX < 20)
+    return 20 - LX;
+  if (engine == PPUEngine::Fifo)
+    return fifoLineDone && LX > 20 ? 113 - LX : 0;
+  if (LX < 63)
+    return LX == 20 ? 0 : 63 - LX;
+  return LX == 63 ? 0 : 113 - LX;
+}
+
+void PPU::tick() {
   bool isLCDOn = LCDC & (1 << 7);
   if (!isLCDOn)
     return;
 
+  if (LY == 0 && LX == 0) {
+    if (requestedEngine != engine) {
+      engine = requestedEngine;
+      updateWorker();
+    }
+    hidingFrame = hideRequested;
+    skippingFrame = skipRequested || hidingFrame;
+  }
+
   if (LX == 0) {
     if (STAT & (1 << 6) && LY == LYC) {
       bus->raiseInterrupt(interruptLCDC);
@@ -401,15 +712,6 @@ void PPU::step() {
     }
   }
 
-  uint16_t windowTileMap = LCDC & (1 << 6) ? 0x9C00 : 0x9800;
-  bool showWindow = LCDC & (1 << 5);
-  uint16_t tileDataBase = LCDC & (1 << 4) ? 0x8000 : 0x9000;
-  bool signedTileIndex = (LCDC & (1 << 4)) == 0;
-  uint16_t bgTileMapDisplay = LCDC & (1 << 3) ? 0x9C00 : 0x9800;
-  uint8_t spriteHeight = LCDC & (1 << 2) ? 16 : 8;
-  bool showSprites = LCDC & (1 << 1);
-  bool showBGAndWindow = LCDC & 1;
-
   int mode = 0b01;
   if (LY < 144) {
     if (WY == LY) {
@@ -418,136 +720,35 @@ void PPU::step() {
 
     if (LX < 20) {
       mode = 0b10;
+    } else if (engine == PPUEngine::Fifo) {
+      mode = stepFifo() ? 0b00 : 0b11;
     } else if (LX < 63) {
       mode = 0b11;
     } else {
       mode = 0b00;
-      if (LX == 63) {
-        showWindow = showWindow && windowEnabled;
-        if (WX > 166 || WY > 143)
-          showWindow = false;
-        bool renderedWindow = false;
-        uint8_t yy = LY + SCY;
-        uint8_t yt = yy / 8;
-
-        std::vector<Sprite> sprites;
-        if (showSprites) {
-          sprites.reserve(10);
-          std::vector<Sprite> unsortedSprites;
-          unsortedSprites.reserve(40);
-          for (int spIndex = 0; spIndex < 40; spIndex++) {
-            uint8_t y = oam[4 * spIndex];
-            if (LY < y - 16 || LY >= y + spriteHeight - 16)
-              continue;
-
-            uint8_t x = oam[4 * spIndex + 1];
-            uint8_t tile = oam[4 * spIndex + 2];
-            uint8_t attributes = oam[4 * spIndex + 3];
-            unsortedSprites.emplace_back(x, y, tile, attributes);
-          }
-          while (unsortedSprites.size() > 0 && sprites.size() < 10) {
-            uint8_t leftmostIndex = 0;
-            uint8_t leftmostX = 168;
-            for (int i = 0; i < unsortedSprites.size(); i++) {
-              if (unsortedSprites[i].x < leftmostX) {
-                leftmostX = unsortedSprites[i].x;
-                leftmostIndex = i;
-              }
-            }
-            sprites.push_back(unsortedSprites[leftmostIndex]);
-            unsortedSprites.erase(unsortedSprites.begin() + leftmostIndex);
-          }
-        }
-
-        mtx.lock();
-        for (int x = 0; x < 20 * 8; x++) {
-          bool showWindowThisPixel = showWindow;
-          if (LY < WY || x < WX - 7)
-            showWindowThisPixel = false;
-          uint8_t xx = x + SCX;
-          uint8_t xt = xx / 8;
-
-          int bgtile = read(bgTileMapDisplay + yt * 32 + xt);
-          int color = getColorForTile(tileDataBase, signedTileIndex, bgtile,
-                                      xx % 8, yy % 8);
-          if (!showBGAndWindow) {
-            color = 0;
-          }
-          if (showWindowThisPixel) {
-            renderedWindow = true;
-            uint8_t yw = WLY;
-            uint8_t xw = x - WX + 7;
-            yt = yw / 8;
-            xt = xw / 8;
-            int wintile = read(windowTileMap + yt * 32 + xt);
-            color = getColorForTile(tileDataBase, signedTileIndex, wintile,
-                                    xw % 8, yw % 8);
-          }
-          uint8_t palette = BGP;
-          if (showSprites) {
-            uint8_t spriteColor = 0;
-            bool bgPriority = false;
-            uint8_t spritePalette = 0;
-            for (Sprite &sprite : sprites) {
-              if (x >= sprite.x - 8 && x < sprite.x) {
-                uint8_t yt = (LY - (sprite.y - 16)) % 8;
-                uint8_t xt = x - (sprite.x - 8);
-                yt = sprite.attributes & 0x40 ? (7 - yt) : yt;
-                xt = sprite.attributes & 0x20 ? (7 - xt) : xt;
-                if (spriteHeight == 16) {
-                  uint8_t topSprite = sprite.attributes & 0x40
-                                          ? (sprite.tile | 0x1)
-                                          : (sprite.tile & 0xFE);
-                  if (LY >= sprite.y - 8) {
-                    spriteColor =
-                        getColorForTile(0x8000, false, topSprite ^ 0x1, xt, yt);
-                  } else {
-                    spriteColor =
-                        getColorForTile(0x8000, false, topSprite, xt, yt);
-                  }
-                } else {
-                  spriteColor =
-                      getColorForTile(0x8000, false, sprite.tile, xt, yt);
-                }
-
-                if (spriteColor != 0) {
-                  spritePalette = sprite.attributes & 0x10 ? OBP1 : OBP0;
-                  bgPriority = sprite.attributes & 0x80;
-                  break;
-                }
-              }
-            }
-            if (spriteColor != 0 && (!bgPriority || color == 0)) {
-              color = spriteColor;
-              palette = spritePalette;
-            }
-          }
-          uint32_t paletteColors[] = {0xf7bef7, 0xe78686, 0x7733e7, 0x2c2c96};
-          uint8_t paletteIndex = (palette >> (2 * color)) & 0x3;
-
-          color = paletteColors[paletteIndex];
-
-          int ri = 3 * (WIDTH * LY + x);
-          int gi = 3 * (WIDTH * LY + x) + 1;
-          int bi = 3 * (WIDTH * LY + x) + 2;
-
-          pixels[ri] = (color >> 16) & 0xFF;
-          pixels[gi] = (color >> 8) & 0xFF;
-          pixels[bi] = color & 0xFF;
-        }
-        mtx.unlock();
-
-        if (renderedWindow)
-          WLY++;
+      if (LX == 63 && !skippingFrame) {
+        if (worker)
+          worker->drawLine(lineRegisters());
+        else
+          renderer.drawLine(lineRegisters());
       }
     }
   } else {
     mode = 0b01;
     if (LY == 144 && LX == 0) {
-      WLY = 0;
       bus->raiseInterrupt(interruptVblank);
-      frame++;
-      invalidate();
+      vblankStarted = true;
+      vblanks++;
+      if (!hidingFrame) {
+        frame++;
+        shownFrames++;
+        InputStamp input = bus->getJoypad().takeReadInput();
+        if (worker)
+          worker->finishFrame(skippingFrame, input);
+        else
+          renderer.finishFrame(skippingFrame, input);
+      }
+      fifo.startFrame();
     }
     windowEnabled = false;
   }
@@ -566,90 +767,61 @@ void PPU::step() {
 }
 
 void PPU::render() {
-  bool showVRAM = true;
-
-  while (!glfwWindowShouldClose(window)) {
-    glfwPollEvents();
-
-    if (invalidated) {
-      invalidated = false;
-
-      mtx.lock(); // TODO: go back to editing textureData directly
-      memcpy(textureData, pixels, HEIGHT * WIDTH * BYTES_PER_PIXEL);
-      mtx.unlock();
-      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
-
-      glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
-      glBindTexture(GL_TEXTURE_2D, screenTexture);
-      glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, WIDTH, HEIGHT, 0, GL_RGB,
-                   GL_UNSIGNED_BYTE, 0);
-      textureData =
-          (GLubyte *)glMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
-      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
-      if (!textureData) {
-        std::cerr << "Couldn't Map Pixel Buffer!" << std::endl;
-        GLenum err = glGetError();
-        std::cerr << "OpenGL Error: " << err << std::endl;
+  while (!glfwWindowShouldClose(window) && !hasClosed) {
+    // Sleeps until a frame is published or input arrives. Publishing posts
+    // an empty event, the timeout only keeps the UI ticking while the
+    // emulation is paused.
+    glfwWaitEventsTimeout(0.25);
+    uint64_t presentStart = hostTime();
+
+    TripleBuffer &frames = renderer.getFrames();
+    InputStamp presentedInput;
+    bool acquired = frames.acquire();
+    bool incremental = false;
+    if (acquired) {
+      const Frame &latest = frames.frontBuffer();
+      incremental = latest.follows(presentedSequence);
+      presentedSequence = latest.sequence;
+      presentedInput = latest.input;
+
+      // Only the lines that changed since the frame already in the texture.
+      int first = incremental ? latest.firstDirtyLine : 0;
+      int last = incremental ? latest.lastDirtyLine : HEIGHT - 1;
+      if (first <= last) {
+        glBindTexture(GL_TEXTURE_2D, screenTexture);
+        GLenum format, type;
+        textureFormat(format, type);
+        int stride = WIDTH * bytesPerPixel(getPixelFormat());
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, first, WIDTH, last - first + 1,
+                        format, type, &latest.pixels[first * stride]);
       }
-
-      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, tileMapPBO);
-      GLubyte *tilemap =
-          (GLubyte *)glMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
-
-      mtx.lock();
-      for (int y = 0; y < tileMapHeight / 8; y++) {
-        for (int x = 0; x < tileMapWidth / 8; x++) {
-          for (int yt = 0; yt < 8; yt++) {
-            for (int xt = 0; xt < 8; xt++) {
-              int color = getColorForTileWholeMap(y * 16 + x, xt, yt);
-              color = color * 0xFF / 3;
-              color = color & 0xFF;
-              color = (color << 16) | (color << 8) | color;
-
-              tilemap[3 * ((8 * y + yt) * tileMapWidth + 8 * x + xt) + 0] =
-                  color;
-              tilemap[3 * ((8 * y + yt) * tileMapWidth + 8 * x + xt) + 1] =
-                  color;
-              tilemap[3 * ((8 * y + yt) * tileMapWidth + 8 * x + xt) + 2] =
-                  color;
-            }
-          }
-        }
-      }
-      mtx.unlock();
-
-      glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
-      glBindTexture(GL_TEXTURE_2D, tileMapViewer);
-      glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, tileMapWidth, tileMapHeight, 0,
-                   GL_RGB, GL_UNSIGNED_BYTE, 0);
-      glBindTexture(GL_TEXTURE_2D, 0);
-      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
     }
 
-    ImGui_ImplOpenGL3_NewFrame();
-    ImGui_ImplGlfw_NewFrame();
-    ImGui::NewFrame();
-
-    ImGui::ShowDemoWindow();
+    // The VRAM viewer is only kept up to date while it is shown.
+    if (!showDebugUI) {
+      viewerStale |= acquired;
+    } else if (acquired || viewerStale) {
+      updateViewer(frames.frontBuffer(), incremental && !viewerStale);
+      viewerStale = false;
+    }
 
-    {
-      ImGui::Begin("Hello World!");
+    if (showDebugUI) {
+      ImGui_ImplOpenGL3_NewFrame();
+      ImGui_ImplGlfw_NewFrame();
+      ImGui::NewFrame();
 
-      ImGui::Text("Useful text!");
-      {
-        ImGui::Text("Show VRAM Here:");
+      ImGui::Begin("VRAM");
+      float width = ImGui::GetContentRegionAvailWidth() * 0.8f;
+      ImGui::Image((void *)(intptr_t)tileMapViewer,
+                   ImVec2(width, width * tileMapHeight / (float)tileMapWidth));
+      ImGui::End();
 
-        ImGui::SetNextItemWidth(ImGui::GetContentRegionAvailWidth() * 0.5f);
-        float width = ImGui::GetContentRegionAvailWidth() * 0.8f;
-        ImGui::Image(
-            (void *)(intptr_t)tileMapViewer,
-            ImVec2(width, width * tileMapHeight / (float)tileMapWidth));
-      }
+      drawPerformanceWindow();
+      drawLatencyWindow();
 
-      ImGui::End();
+      ImGui::Render();
     }
 
-    ImGui::Render();
     int display_w, display_h;
     glfwGetFramebufferSize(window, &display_w, &display_h);
     glViewport(0, 0, display_w, display_h);
@@ -657,27 +829,130 @@ void PPU::render() {
     glClear(GL_COLOR_BUFFER_BIT);
 
     glUseProgram(shaderProgram);
+    bool indexed = getPixelFormat() == PixelFormat::Indexed;
+    glUniform1i(indexedUniform, indexed);
+    if (indexed) {
+      int palette = getPalette();
+      float colors[4 * 3];
+      for (int shade = 0; shade < 4; shade++)
+        for (int c = 0; c < 3; c++)
+          colors[3 * shade + c] =
+              ((dmgPalettes[palette].colors[shade] >> (16 - 8 * c)) & 0xFF) /
+              255.0f;
+      glUniform3fv(paletteUniform, 4, colors);
+    }
     glBindTexture(GL_TEXTURE_2D, screenTexture);
     glBindVertexArray(vao);
     glDrawArrays(GL_TRIANGLES, 0, 6);
-    ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+    if (showDebugUI)
+      ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
 
     glfwSwapBuffers(window);
+    uint64_t presented = hostTime();
+    if (acquired)
+      perfStats.addPresent(presented - presentStart);
+    // The swap returning is as close to the photons as GLFW gets.
+    if (presentedInput.hostTime)
+      inputLatency.add(presentedInput, presented);
+  }
+}
+
+void PPU::updateViewer(const Frame &frame, bool incremental) {
+  // Redraw the tiles that changed, and upload the rows of tiles they are in.
+  unsigned int tilesPerRow = tileMapWidth / 8;
+  glBindTexture(GL_TEXTURE_2D, tileMapViewer);
+  for (unsigned int y = 0; y < tileMapHeight / 8; y++) {
+    bool rowChanged = false;
+    for (unsigned int x = 0; x < tilesPerRow; x++) {
+      uint16_t tile = y * tilesPerRow + x;
+      if (incremental && !frame.tileChanged(tile))
+        continue;
+      drawViewerTile(frame.tiles, tile);
+      rowChanged = true;
+    }
+    if (rowChanged)
+      glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 8 * y, tileMapWidth, 8, GL_RGB,
+                      GL_UNSIGNED_BYTE,
+                      &tileMapPixels[3 * 8 * y * tileMapWidth]);
   }
+  glBindTexture(GL_TEXTURE_2D, 0);
 }
 
-int8_t PPU::getColorForTileWholeMap(uint16_t index, uint8_t x, uint8_t y) {
-  uint16_t addr = 0x8000 + 0x10 * index + 2 * y;
-  return ((read(addr) >> (7 - x)) & 0x1) |
-         (((read(addr + 1) >> (7 - x)) & 0x1) << 1);
+void PPU::drawPerformanceWindow() {
+  ImGui::Begin("Performance");
+  ImGui::Text("Speed %.1f%% (%.3f MHz), %d FPS, %d changed, %d skipped",
+              perfStats.getSpeed(), perfStats.getClock(),
+              perfStats.getFramesPerSecond(), perfStats.getChangedPerSecond(),
+              perfStats.getSkippedPerSecond());
+
+  float times[PerfStats::historyFrames];
+  int count = perfStats.getFrameTimes(times);
+  float slowest = 0;
+  for (int i = 0; i < count; i++)
+    slowest = std::max(slowest, times[i]);
+  // Bars of 0.5 ms, up to a whole frame at 60 Hz or the slowest frame.
+  constexpr float barWidth = 0.5f;
+  float range = std::max(1000.0f / 60, slowest + barWidth);
+  int bars = std::min<int>(std::ceil(range / barWidth), 128);
+  float histogram[128] = {};
+  for (int i = 0; i < count; i++)
+    histogram[std::min<int>(times[i] / range * bars, bars - 1)]++;
+
+  char overlay[64];
+  snprintf(overlay, sizeof(overlay), "0 - %.1f ms", range);
+  ImGui::PlotHistogram("Frame time", histogram, bars, 0, overlay, 0.0f,
+                       FLT_MAX, ImVec2(0, 64));
+  ImGui::PlotLines("Recent frames", times, count, 0, nullptr, 0.0f, range,
+                   ImVec2(0, 48));
+
+  ImGui::Text("Per frame: CPU %.2f ms, PPU %.2f ms, run-ahead %.2f ms",
+              perfStats.getCPUTime(), perfStats.getPPUTime(),
+              perfStats.getRunAheadTime());
+  ImGui::Text("Present %.2f ms", perfStats.getPresentTime());
+  ImGui::Text("Pacer oversleep %.3f ms, lateness %.2f frames",
+              perfStats.getOversleep(), perfStats.getLateness());
+  ImGui::Text("F1 hides the debug windows");
+  ImGui::End();
 }
 
-int8_t PPU::getColorForTile(uint16_t baseAddr, bool signedTileIndex,
-                            uint8_t index, uint8_t x, uint8_t y) {
-  int16_t offset = (signedTileIndex ? (int8_t)index : (uint8_t)index);
-  uint16_t addr = baseAddr + 0x10 * offset + 2 * y;
-  return ((read(addr) >> (7 - x)) & 0x1) |
-         (((read(addr + 1) >> (7 - x)) & 0x1) << 1);
+void PPU::drawLatencyWindow() {
+  ImGui::Begin("Input latency");
+  ImGui::Text("%u presses measured, from key to the first frame shown after "
+              "the game read it",
+              inputLatency.count());
+  for (int i = 0; i < latencyStageCount; i++) {
+    LatencyStage stage = static_cast<LatencyStage>(i);
+    const LatencyHistogram &histogram = inputLatency.get(stage);
+    float buckets[LatencyHistogram::bucketCount];
+    for (int b = 0; b < LatencyHistogram::bucketCount; b++)
+      buckets[b] = histogram.bucket(b);
+
+    char overlay[64];
+    snprintf(overlay, sizeof(overlay), "p50 %d  p90 %d  p99 %d ms",
+             histogram.percentile(0.5f), histogram.percentile(0.9f),
+             histogram.percentile(0.99f));
+    ImGui::PlotHistogram(latencyStageName(stage), buckets,
+                         LatencyHistogram::bucketCount, 0,
+                         histogram.count() ? overlay : nullptr, 0.0f, FLT_MAX,
+                         ImVec2(0, 48));
+  }
+  ImGui::Text("1 ms per bar, the last one holds everything from 99 ms");
+  ImGui::End();
+}
+
+void PPU::drawViewerTile(const std::vector<uint8_t> &tiles, uint16_t index) {
+  unsigned int tilesPerRow = tileMapWidth / 8;
+  unsigned int left = 8 * (index % tilesPerRow);
+  unsigned int top = 8 * (index / tilesPerRow);
+  for (int y = 0; y < 8; y++) {
+    uint8_t low = tiles[0x10 * index + 2 * y];
+    uint8_t high = tiles[0x10 * index + 2 * y + 1];
+    uint8_t *out = &tileMapPixels[3 * ((top + y) * tileMapWidth + left)];
+    for (int x = 0; x < 8; x++) {
+      int color = ((low >> (7 - x)) & 0x1) | (((high >> (7 - x)) & 0x1) << 1);
+      out[3 * x] = out[3 * x + 1] = out[3 * x + 2] = color * 0xFF / 3;
+    }
+  }
 }
 
 void PPU::cleanup() {
@@ -689,6 +964,16 @@ void PPU::cleanup() {
   ImGui_ImplGlfw_Shutdown();
   ImGui::DestroyContext();
 
+  {
+    std::lock_guard<std::mutex> lock(windowMtx);
+    windowOpen = false;
+  }
   glfwDestroyWindow(window);
   glfwTerminate();
 }
+
+void PPU::wakeWindow() {
+  std::lock_guard<std::mutex> lock(windowMtx);
+  if (windowOpen)
+    glfwPostEmptyEvent();
+}
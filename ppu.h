@@ -2,35 +2,53 @@
 
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
+#include <atomic>
+#include <memory>
 #include <mutex>
+#include <string>
 #include <vector>
 
 #include "bus.h"
+#include "framebuffer.h"
+#include "linerenderer.h"
+#include "perfstats.h"
+#include "pixelfifo.h"
+#include "renderworker.h"
 
 constexpr int SCALE = 6;
-constexpr int WIDTH = 160;
-constexpr int HEIGHT = 144;
-constexpr int BYTES_PER_PIXEL = 3;
+
+// How lines are drawn: all at once when mode 3 ends, or dot by dot through
+// the pixel FIFO, which is slower but shows registers changed mid-line.
+enum class PPUEngine : uint8_t { Scanline, Fifo };
+
+const char *ppuEngineName(PPUEngine engine);
+bool parsePPUEngine(const std::string &name, PPUEngine &engine);
+// The engine a cartridge, by its header title, needs to be drawn correctly.
+PPUEngine engineForTitle(const std::string &title);
 
 class PPU {
 public:
-  uint8_t internalLY = 0;
-  uint8_t internalLX = 0;
-
-  bool joypadDown = false;
-  bool joypadUp = false;
-  bool joypadLeft = false;
-  bool joypadRight = false;
-  bool joypadStart = false;
-  bool joypadSelect = false;
-  bool joypadA = false;
-  bool joypadB = false;
+  // Registers, memory and timing, to be loaded back into the same PPU. The
+  // renderer is not part of it: loading a state sends the VRAM and OAM bytes
+  // that differ to the renderer, which keeps drawing from there.
+  struct State {
+    uint8_t LCDC, STAT;
+    uint8_t BGP, OBP0, OBP1;
+    uint8_t SCY, SCX, LYC, LY, LX, WY, WX;
+    uint8_t windowEnabled;
+    std::vector<uint8_t> vram;
+    std::vector<uint8_t> oam;
+    PPUEngine engine;
+    PixelFifo fifo{nullptr, nullptr};
+    bool fifoLineDone;
+    bool skippingFrame;
+    bool hidingFrame;
+    uint32_t deferrableCycles;
+  };
 
 private:
   Bus *bus;
 
-  uint8_t inputMask = 0;
-
   uint8_t LCDC;
   uint8_t STAT;
 
@@ -44,49 +62,131 @@ private:
   uint8_t LY = 0;
   uint8_t LX = 0;
   uint8_t WY = 0;
-  uint8_t WLY = 0;
   uint8_t WX = 0;
   uint8_t windowEnabled = false;
-  bool invalidated = false;
 
   std::vector<uint8_t> vram;
   std::vector<uint8_t> oam;
 
-  GLubyte *textureData = 0;
-  uint8_t *pixels = 0;
+  // Draws the lines, either inline or behind the emulation on the worker.
+  LineRenderer renderer;
+  std::unique_ptr<RenderWorker> worker;
+  bool useWorker = false;
+
+  PPUEngine engine = PPUEngine::Scanline;
+  std::atomic<PPUEngine> requestedEngine{PPUEngine::Scanline};
+  PixelFifo fifo;
+  bool fifoLineDone = false;
+
+  // Frames are skipped whole: the request is taken when a frame starts, and
+  // a skipped frame still runs with exact timing but draws nothing.
+  bool skipRequested = false;
+  bool skippingFrame = false;
+  // Hidden frames are not drawn either, and do not reach the renderer's
+  // consumers at all, see RunAhead.
+  bool hideRequested = false;
+  bool hidingFrame = false;
+  uint64_t vblanks = 0;
+  uint64_t shownFrames = 0;
+
+  // Cycles that were stepped but not run yet. Most cycles only advance LX,
+  // so they are run in bulk when something looks at or changes the PPU, or
+  // at the latest when the next line starts, which has to happen on time to
+  // raise interrupts.
+  uint32_t pendingCycles = 0;
+  uint32_t deferrableCycles = 0;
+  bool deferCycles = true;
+  // Set while the pending cycles run, anything they reach that wants the PPU
+  // caught up gets it as far as it is.
+  bool catchingUp = false;
+  // VBlank started during the catch-up, its side effects on the rest of the
+  // machine run once the catch-up is done.
+  bool vblankStarted = false;
+  // Time spent running cycles, only every catchUpSampling-th catch-up is
+  // timed so reading the clock does not show up in it.
+  static constexpr uint32_t catchUpSampling = 16;
+  uint32_t catchUps = 0;
+  uint64_t emulationTime = 0;
 
 private:
   GLFWwindow *window;
   unsigned int screenTexture;
-  unsigned int vao, vbo, pbo;
+  unsigned int vao, vbo;
   unsigned int shaderProgram;
+  int indexedUniform;
+  int paletteUniform;
 
-  bool hasClosed = false;
+  std::atomic<bool> hasClosed{false};
+  // F5 was pressed, the emulation resumes if a breakpoint paused it.
+  std::atomic<bool> resumeRequested{false};
+  // Whether GLFW can take events from other threads, guarded so it is not
+  // terminated while one is being posted.
+  std::mutex windowMtx;
+  bool windowOpen = false;
   int frame;
-
-  bool hasSetUp;
-  std::mutex mtx;
+  uint64_t presentedSequence = 0;
+  InputLatency inputLatency;
+  PerfStats perfStats;
+  // The ImGui windows, F1 hides them. While hidden, no ImGui frame is built
+  // and the VRAM viewer is not kept up to date.
+  bool showDebugUI = true;
+  bool viewerStale = true;
 
   // Just ImGui things
-  unsigned int tileMapPBO;
   unsigned int tileMapViewer;
   unsigned int tileMapWidth = 16 * 8;
   unsigned int tileMapHeight = 24 * 8;
+  // RGB pixels of the tile viewer, only tiles that changed are redrawn.
+  std::vector<uint8_t> tileMapPixels;
+
+  void connectIO(IORegisters &io);
+  LineRegisters lineRegisters();
+  void tick();
+  uint32_t idleCyclesAhead();
+  void updateWorker();
+  // Runs the dots of mode 3 in this cycle, returns true once the line is done.
+  bool stepFifo();
+  // Hands a VRAM or OAM write to whatever draws the lines.
+  void forwardWrite(uint16_t addr, uint8_t value) {
+    if (worker)
+      worker->write(addr, value);
+    else
+      renderer.write(addr, value);
+  }
+  void textureFormat(GLenum &format, GLenum &type);
+  // Wakes the render loop up, from any thread.
+  void wakeWindow();
 
 public:
   PPU(Bus *bus);
 
-  void step();
-  int8_t getColorForTile(uint16_t baseAddr, bool signedTileIndex, uint8_t index,
-                         uint8_t x, uint8_t y);
-  int8_t getColorForTileWholeMap(uint16_t index, uint8_t x, uint8_t y);
+  // Puts the PPU and VRAM in the state the boot ROM leaves them in, with the
+  // logo from the cartridge header in the background.
+  void skipBoot();
+
+  void step() {
+    if (++pendingCycles > deferrableCycles)
+      catchUp();
+  }
+  // Runs the pending cycles. Has to be called before anything that depends
+  // on or changes the PPU's timing or memory.
+  void catchUp();
+  // Off, every cycle is run as it is stepped. Much slower, only there to
+  // check the deferred cycles against, see selftest.h.
+  void setDeferCycles(bool defer) {
+    catchUp();
+    deferCycles = defer;
+    catchUp();
+  }
+  void updateViewer(const Frame &frame, bool incremental);
+  void drawPerformanceWindow();
+  void drawLatencyWindow();
+  void drawViewerTile(const std::vector<uint8_t> &tiles, uint16_t index);
 
   void setup();
   void render();
   void cleanup();
 
-  void invalidate();
-
   void raiseInterrupt(uint8_t interrupt);
 
   uint8_t read(uint16_t addr);
@@ -95,10 +195,97 @@ public:
   bool isClosed();
   void close();
 
+  // VRAM can be read directly, but writes have to go through write() to reach
+  // the renderer.
+  const uint8_t *getVRam() { return vram.data(); }
+
+  // Selects one of dmgPalettes by name or index.
+  bool setPalette(const std::string &name);
+  void setPalette(int index) { renderer.setPalette(index); }
+  int getPalette() { return renderer.getPalette(); }
+
+  // Layout of the frames the PPU produces, has to be set before setup().
+  void setPixelFormat(PixelFormat format) { renderer.setPixelFormat(format); }
+  PixelFormat getPixelFormat() { return renderer.getPixelFormat(); }
+
+  // Draws lines on a separate thread instead of in step(). Has to be set
+  // before the emulation starts.
+  void setRenderWorker(bool enabled);
+
+  // Hands every finished frame to recorder, or stops recording for nullptr.
+  // Has to be called while the emulation is stopped.
+  void setRecorder(Recorder *recorder);
+  // Hashes every drawn frame at VBlank, see LineRenderer. The handler runs on
+  // the render worker when there is one. Has to be called while the
+  // emulation is stopped.
+  void setFrameHashHandler(void *context, FrameHashHandler handler,
+                           bool lines);
+
+  // Switches the engine at the start of the next frame. Can be called from
+  // any thread.
+  void setEngine(PPUEngine engine) { requestedEngine = engine; }
+  void toggleEngine() {
+    setEngine(requestedEngine == PPUEngine::Scanline ? PPUEngine::Fifo
+                                                     : PPUEngine::Scanline);
+  }
+  PPUEngine getEngine() { return requestedEngine; }
+
+  // Whether the next frame that starts is drawn.
+  void skipNextFrame(bool skip) { skipRequested = skip; }
+  // Whether the frames that start from now on are hidden.
+  void hideFrames(bool hide) { hideRequested = hide; }
+  // Every VBlank so far, of hidden frames too.
+  uint64_t getVBlanks() const { return vblanks; }
+  // Frames that were not hidden, drawn or skipped, finished so far.
+  uint64_t getShownFrames() const { return shownFrames; }
+
+  // Runs the pending cycles first, so the state is exact.
+  void saveState(State &state);
+  void loadState(const State &state);
+
+  // Sprites selected for a line the last time it was drawn.
+  const SpriteLine &getSprites(uint8_t line) {
+    return renderer.getSprites(line);
+  }
+
   void setFrame(int frame) { this->frame = frame; }
   int getFrame() { return frame; }
-  void setLX(uint8_t LX) { this->LX = LX; }
-  uint8_t getLX() { return LX; }
-  void setLY(uint8_t LY) { this->LY = LY; }
-  uint8_t getLY() { return LY; }
+  int takePublishedFrames() { return renderer.takePublishedFrames(); }
+  // Finished frames for consumers other than the window. Only one thread may
+  // acquire them at a time.
+  TripleBuffer &getFrames() { return renderer.getFrames(); }
+  // Where the window sends key presses.
+  Joypad &getJoypad() { return bus->getJoypad(); }
+  // Filled as frames carrying input are presented, can be read from any
+  // thread.
+  const InputLatency &getInputLatency() const { return inputLatency; }
+  // Filled by the emulation and the presenter, shown in the debug UI.
+  PerfStats &getPerfStats() { return perfStats; }
+  // Time spent running PPU cycles since the last call, in nanoseconds.
+  uint64_t takeEmulationTime() {
+    uint64_t time = emulationTime;
+    emulationTime = 0;
+    return time;
+  }
+  void toggleDebugUI() { showDebugUI = !showDebugUI; }
+  void requestResume() { resumeRequested = true; }
+  // Whether resuming was asked for since the last call.
+  bool takeResume() { return resumeRequested.exchange(false); }
+  void setLX(uint8_t LX) {
+    catchUp();
+    this->LX = LX;
+    catchUp();
+  }
+  uint8_t getLX() {
+    catchUp();
+    return LX;
+  }
+  void setLY(uint8_t LY) {
+    catchUp();
+    this->LY = LY;
+  }
+  uint8_t getLY() {
+    catchUp();
+    return LY;
+  }
 };
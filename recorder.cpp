@@ -0,0 +1,201 @@
+#include "recorder.h"
+
+#include <algorithm>
+#include <csignal>
+#include <cstring>
+
+#include "linerenderer.h"
+
+bool parseVideoContainer(const std::string &name, VideoContainer &container) {
+  if (name == "y4m")
+    container = VideoContainer::Y4M;
+  else if (name == "raw")
+    container = VideoContainer::Raw;
+  else
+    return false;
+  return true;
+}
+
+bool parseQueuePolicy(const std::string &name, QueuePolicy &policy) {
+  if (name == "drop")
+    policy = QueuePolicy::Drop;
+  else if (name == "block")
+    policy = QueuePolicy::Block;
+  else
+    return false;
+  return true;
+}
+
+Recorder::Recorder(VideoContainer container, QueuePolicy policy,
+                   int queueFrames, PixelFormat format, ScaleFilter filter,
+                   int factor)
+    : container(container), policy(policy), format(format),
+      // Leaves a core for the emulation.
+      scaler(filter, factor,
+             std::max<int>(std::thread::hardware_concurrency() - 1, 1)),
+      slots(std::max(queueFrames, 1)) {
+  for (Slot &slot : slots)
+    slot.pixels.resize(WIDTH * HEIGHT * bytesPerPixel(format));
+}
+
+Recorder::~Recorder() { stop(); }
+
+bool Recorder::start(const std::string &target) {
+  if (!target.empty() && target[0] == '|') {
+    // An encoder that exits early should fail the recording, not kill the
+    // emulator.
+    signal(SIGPIPE, SIG_IGN);
+    file = popen(target.c_str() + 1, "w");
+    isPipe = true;
+  } else {
+    file = fopen(target.c_str(), "wb");
+  }
+  if (!file)
+    return false;
+
+  int width = WIDTH * scaler.getFactor();
+  int height = HEIGHT * scaler.getFactor();
+  if (container == VideoContainer::Y4M) {
+    // 4194304 Hz / 70224 cycles per frame.
+    fprintf(file, "YUV4MPEG2 W%d H%d F262144:4389 Ip A1:1 C420jpeg\n", width,
+            height);
+    rgb.resize(3 * width * height);
+    encoded.reserve(6 + width * height * 3 / 2);
+  } else {
+    encoded.reserve(3 * width * height);
+  }
+
+  thread = std::thread(&Recorder::run, this);
+  return true;
+}
+
+bool Recorder::stop() {
+  if (!file)
+    return !writeFailed;
+
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    stopping = true;
+  }
+  frameQueued.notify_one();
+  thread.join();
+
+  int closed = isPipe ? pclose(file) : fclose(file);
+  file = nullptr;
+  return !writeFailed && closed == 0;
+}
+
+void Recorder::addFrame(const uint8_t *pixels, const uint32_t shadeColors[4]) {
+  if (!pixels) {
+    pendingRepeats++;
+    return;
+  }
+
+  uint32_t next = tail.load(std::memory_order_relaxed);
+  if (next - head.load(std::memory_order_acquire) == slots.size()) {
+    if (policy == QueuePolicy::Drop) {
+      pendingRepeats++;
+      droppedFrames++;
+      return;
+    }
+    std::unique_lock<std::mutex> lock(mtx);
+    frameWritten.wait(lock, [&] { return next - head.load() < slots.size(); });
+  }
+
+  Slot &slot = slots[next % slots.size()];
+  memcpy(slot.pixels.data(), pixels, slot.pixels.size());
+  memcpy(slot.shadeColors, shadeColors, sizeof(slot.shadeColors));
+  slot.repeats = pendingRepeats;
+  pendingRepeats = 0;
+
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    tail.store(next + 1, std::memory_order_release);
+  }
+  frameQueued.notify_one();
+}
+
+void Recorder::run() {
+  uint32_t next = 0;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(mtx);
+      frameQueued.wait(lock, [&] { return tail.load() != next || stopping; });
+      if (tail.load() == next)
+        break;
+    }
+
+    const Slot &slot = slots[next % slots.size()];
+    // Nothing to repeat before the first frame.
+    if (!encoded.empty())
+      for (int i = 0; i < slot.repeats; i++)
+        writeEncoded();
+    encode(slot);
+    writeEncoded();
+
+    {
+      std::lock_guard<std::mutex> lock(mtx);
+      head.store(++next, std::memory_order_release);
+    }
+    frameWritten.notify_one();
+  }
+
+  // The producer is done once stopping, so the frames it skipped or dropped
+  // after the last one it queued can be written too.
+  if (!encoded.empty())
+    for (int i = 0; i < pendingRepeats; i++)
+      writeEncoded();
+}
+
+void Recorder::encode(const Slot &slot) {
+  int width = WIDTH * scaler.getFactor();
+  int height = HEIGHT * scaler.getFactor();
+  if (container == VideoContainer::Raw) {
+    encoded.resize(3 * width * height);
+    scaler.scale(slot.pixels.data(), WIDTH, HEIGHT, format, slot.shadeColors,
+                 encoded.data());
+    return;
+  }
+  scaler.scale(slot.pixels.data(), WIDTH, HEIGHT, format, slot.shadeColors,
+               rgb.data());
+
+  // BT.601 in video range, with chroma averaged over 2x2 pixels.
+  static const char frameHeader[] = "FRAME\n";
+  encoded.resize(6 + width * height * 3 / 2);
+  memcpy(encoded.data(), frameHeader, 6);
+  uint8_t *luma = encoded.data() + 6;
+  uint8_t *blue = luma + width * height;
+  uint8_t *red = blue + width * height / 4;
+
+  for (int i = 0; i < width * height; i++) {
+    int r = rgb[3 * i], g = rgb[3 * i + 1], b = rgb[3 * i + 2];
+    luma[i] = ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+  }
+  for (int y = 0; y < height / 2; y++) {
+    for (int x = 0; x < width / 2; x++) {
+      int r = 0, g = 0, b = 0;
+      for (int i = 0; i < 4; i++) {
+        const uint8_t *pixel =
+            &rgb[3 * ((2 * y + i / 2) * width + 2 * x + i % 2)];
+        r += pixel[0];
+        g += pixel[1];
+        b += pixel[2];
+      }
+      r /= 4;
+      g /= 4;
+      b /= 4;
+      int chroma = y * width / 2 + x;
+      blue[chroma] = ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+      red[chroma] = ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+    }
+  }
+}
+
+void Recorder::writeEncoded() {
+  if (writeFailed)
+    return;
+  if (fwrite(encoded.data(), 1, encoded.size(), file) != encoded.size())
+    writeFailed = true;
+  else
+    writtenFrames++;
+}
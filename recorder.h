@@ -0,0 +1,91 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "framebuffer.h"
+#include "scaler.h"
+
+enum class VideoContainer : uint8_t {
+  Y4M, // YUV 4:2:0 with a header, readable by most encoders.
+  Raw, // Bare RGB888 frames.
+};
+
+// What happens to a frame when the recording queue is full.
+enum class QueuePolicy : uint8_t {
+  Drop,  // The frame is not recorded, the one before it is written again.
+  Block, // The emulation waits for the writer.
+};
+
+bool parseVideoContainer(const std::string &name, VideoContainer &container);
+bool parseQueuePolicy(const std::string &name, QueuePolicy &policy);
+
+// Records every finished frame to a file, or to a command reading the video
+// from its stdin when the target starts with '|'. Frames are copied into a
+// bounded queue and scaled, converted and written on a separate thread, so
+// the emulation only pays for the copy.
+class Recorder {
+  struct Slot {
+    std::vector<uint8_t> pixels;
+    uint32_t shadeColors[4];
+    // Frames that were skipped or dropped right before this one, the last
+    // recorded frame is written again for each.
+    int repeats;
+  };
+
+  VideoContainer container;
+  QueuePolicy policy;
+  PixelFormat format;
+  Scaler scaler;
+
+  FILE *file = nullptr;
+  bool isPipe = false;
+
+  // Single producer, single consumer ring of frames.
+  std::vector<Slot> slots;
+  std::atomic<uint32_t> head{0};
+  std::atomic<uint32_t> tail{0};
+  int pendingRepeats = 0;
+
+  std::mutex mtx;
+  std::condition_variable frameQueued;
+  std::condition_variable frameWritten;
+  bool stopping = false;
+  std::thread thread;
+
+  // Writer side.
+  std::vector<uint8_t> rgb;
+  std::vector<uint8_t> encoded;
+  bool writeFailed = false;
+  std::atomic<int> writtenFrames{0};
+  std::atomic<int> droppedFrames{0};
+
+  void run();
+  void encode(const Slot &slot);
+  void writeEncoded();
+
+public:
+  Recorder(VideoContainer container, QueuePolicy policy, int queueFrames,
+           PixelFormat format, ScaleFilter filter, int factor);
+  ~Recorder();
+
+  // Opens the target and starts the writer. Returns false if the target
+  // could not be opened.
+  bool start(const std::string &target);
+  // Writes the frames still queued and closes the target. Returns false if
+  // writing failed at some point.
+  bool stop();
+
+  // Called with every finished frame in the recorder's pixel format. Frames
+  // that were not drawn are passed as nullptr.
+  void addFrame(const uint8_t *pixels, const uint32_t shadeColors[4]);
+
+  int getWrittenFrames() const { return writtenFrames; }
+  int getDroppedFrames() const { return droppedFrames; }
+};
@@ -0,0 +1,75 @@
+#include "renderworker.h"
+
+RenderWorker::RenderWorker(LineRenderer &renderer)
+    : renderer(renderer), writes(writeCapacity), records(recordCapacity),
+      thread(&RenderWorker::run, this) {}
+
+RenderWorker::~RenderWorker() {
+  push(RecordKind::Stop);
+  thread.join();
+}
+
+void RenderWorker::write(uint16_t addr, uint8_t value) {
+  if (writeTail - writeHead.load(std::memory_order_acquire) ==
+      writeCapacity) {
+    // The writes may not be followed by a line for a while, e.g. while the
+    // LCD is off, so hand them over before waiting for the worker.
+    push(RecordKind::Writes);
+    while (writeTail - writeHead.load(std::memory_order_acquire) ==
+           writeCapacity)
+      std::this_thread::yield();
+  }
+  writes[writeTail % writeCapacity] = {addr, value};
+  writeTail++;
+}
+
+void RenderWorker::push(RecordKind kind, const LineRegisters &registers,
+                        const InputStamp &input) {
+  uint32_t tail = recordTail.load(std::memory_order_relaxed);
+  while (tail - recordHead.load(std::memory_order_acquire) == recordCapacity)
+    std::this_thread::yield();
+  records[tail % recordCapacity] = {kind, registers, input, writeTail};
+  recordTail.store(tail + 1);
+
+  if (sleeping.load()) {
+    std::lock_guard<std::mutex> lock(mtx);
+    wakeUp.notify_one();
+  }
+}
+
+void RenderWorker::run() {
+  uint32_t head = 0;
+  uint32_t writeIndex = 0;
+  while (true) {
+    if (recordTail.load(std::memory_order_acquire) == head) {
+      std::unique_lock<std::mutex> lock(mtx);
+      sleeping = true;
+      wakeUp.wait(lock, [&] { return recordTail.load() != head; });
+      sleeping = false;
+    }
+
+    const Record &record = records[head % recordCapacity];
+    for (; writeIndex != record.writesEnd; writeIndex++) {
+      const Write &write = writes[writeIndex % writeCapacity];
+      renderer.write(write.addr, write.value);
+    }
+    writeHead.store(writeIndex, std::memory_order_release);
+
+    switch (record.kind) {
+    case RecordKind::Line:
+      renderer.drawLine(record.registers);
+      break;
+    case RecordKind::Frame:
+      renderer.finishFrame(false, record.input);
+      break;
+    case RecordKind::SkippedFrame:
+      renderer.finishFrame(true, record.input);
+      break;
+    case RecordKind::Writes:
+      break;
+    case RecordKind::Stop:
+      return;
+    }
+    recordHead.store(++head, std::memory_order_release);
+  }
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "linerenderer.h"
+
+// Runs a LineRenderer on its own thread. The emulation thread only logs the
+// VRAM and OAM writes and the registers of every line, and the worker
+// replays them in the same order, so changes made in the middle of a frame
+// still land on the right lines.
+//
+// The log is two single producer, single consumer rings: one of writes and
+// one of records that each tell the worker how many of the writes come
+// before them. The producer waits when either ring is full.
+class RenderWorker {
+  struct Write {
+    uint16_t addr;
+    uint8_t value;
+  };
+
+  enum class RecordKind : uint8_t { Line, Frame, SkippedFrame, Writes, Stop };
+
+  struct Record {
+    RecordKind kind;
+    LineRegisters registers;
+    InputStamp input;
+    uint32_t writesEnd;
+  };
+
+  static constexpr uint32_t writeCapacity = 1 << 16;
+  static constexpr uint32_t recordCapacity = 1 << 10;
+
+  LineRenderer &renderer;
+
+  std::vector<Write> writes;
+  std::vector<Record> records;
+  // Only used by the producer, handed to the worker through the records.
+  uint32_t writeTail = 0;
+  std::atomic<uint32_t> writeHead{0};
+  std::atomic<uint32_t> recordTail{0};
+  std::atomic<uint32_t> recordHead{0};
+
+  std::mutex mtx;
+  std::condition_variable wakeUp;
+  std::atomic<bool> sleeping{false};
+
+  std::thread thread;
+
+  void push(RecordKind kind, const LineRegisters &registers = {},
+            const InputStamp &input = {});
+  void run();
+
+public:
+  RenderWorker(LineRenderer &renderer);
+  ~RenderWorker();
+
+  void write(uint16_t addr, uint8_t value);
+  void drawLine(const LineRegisters &registers) {
+    push(RecordKind::Line, registers);
+  }
+  void finishFrame(bool skipped, const InputStamp &input) {
+    push(skipped ? RecordKind::SkippedFrame : RecordKind::Frame, {}, input);
+  }
+};
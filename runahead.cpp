@@ -0,0 +1,47 @@
+#include "runahead.h"
+
+#include "instructions.h"
+
+constexpr int cyclesPerFrame = 17556;
+
+RunAhead::RunAhead(CPU &cpu, Bus &bus, PPU &ppu, int frames)
+    : cpu(cpu), bus(bus), ppu(ppu), frames(frames) {
+  ppu.hideFrames(true);
+}
+
+RunAhead::~RunAhead() { ppu.hideFrames(false); }
+
+void RunAhead::speculate() {
+  cpu.saveState(cpuState);
+  bus.saveState(busState);
+  ppu.saveState(ppuState);
+
+  Joypad &joypad = bus.getJoypad();
+  joypad.setSpeculating(true);
+  bus.getCounters().setSpeculating(true);
+
+  // The frame shown is the first one that starts after frames - 1 VBlanks.
+  // The limit only matters while the LCD is off.
+  uint64_t vblanks = ppu.getVBlanks();
+  uint64_t shownFrames = ppu.getShownFrames();
+  ppu.hideFrames(frames > 1);
+  for (int cycle = 0; cycle < (frames + 1) * cyclesPerFrame; cycle++) {
+    ppu.step();
+    joypad.step();
+    // The real run stops at the breakpoint once it gets there.
+    if (!cpu.step())
+      break;
+    if (ppu.getShownFrames() != shownFrames)
+      break;
+    if (ppu.getVBlanks() - vblanks == uint64_t(frames - 1))
+      ppu.hideFrames(false);
+  }
+
+  cpu.loadState(cpuState);
+  bus.loadState(busState);
+  ppu.loadState(ppuState);
+  cpu.clearBreakpoint();
+  joypad.setSpeculating(false);
+  bus.getCounters().setSpeculating(false);
+  ppu.hideFrames(true);
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "bus.h"
+#include "gb.h"
+#include "ppu.h"
+
+// Hides the game's own input lag. After every real frame the emulator saves
+// its state in memory, runs ahead with the input it has until the frame
+// that many VBlanks ahead is finished, shows that frame, and loads the state
+// again. Real frames are hidden, so the window, the recorder and frame
+// hashes see exactly one frame, the one from the future, per real frame.
+//
+// The state is not written anywhere, and its memory buffers are reused, so
+// saving and loading mostly copy a few tens of KB. The one allocation is an
+// instruction in the middle of executing, which is cloned on every save and
+// every load, the same as decoding one.
+class RunAhead {
+  CPU &cpu;
+  Bus &bus;
+  PPU &ppu;
+  int frames;
+
+  CPU::State cpuState;
+  Bus::State busState;
+  PPU::State ppuState;
+
+public:
+  RunAhead(CPU &cpu, Bus &bus, PPU &ppu, int frames);
+  ~RunAhead();
+
+  // Called at every frame boundary, after the input for the next frame was
+  // scheduled.
+  void speculate();
+};
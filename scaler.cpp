@@ -0,0 +1,244 @@
+#include "scaler.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "simd.h"
+
+namespace {
+
+// xBR looks up to two pixels away, the other filters one.
+constexpr int padding = 2;
+
+// Converts a row of pixels to 0xRRGGBB.
+void widenRow(const uint8_t *pixels, int width, PixelFormat format,
+              const uint32_t shadeColors[4], uint32_t *out) {
+  switch (format) {
+  case PixelFormat::RGB888:
+  case PixelFormat::RGBA8888: {
+    int bytes = bytesPerPixel(format);
+    for (int x = 0; x < width; x++) {
+      const uint8_t *pixel = pixels + bytes * x;
+      out[x] = (pixel[0] << 16) | (pixel[1] << 8) | pixel[2];
+    }
+    break;
+  }
+  case PixelFormat::RGB565:
+    for (int x = 0; x < width; x++) {
+      uint16_t pixel;
+      memcpy(&pixel, pixels + 2 * x, 2);
+      uint32_t r = pixel >> 11, g = (pixel >> 5) & 0x3F, b = pixel & 0x1F;
+      out[x] = (((r << 3) | (r >> 2)) << 16) | (((g << 2) | (g >> 4)) << 8) |
+               ((b << 3) | (b >> 2));
+    }
+    break;
+  case PixelFormat::Indexed:
+    for (int x = 0; x < width; x++)
+      out[x] = shadeColors[pixels[x] & 0x3];
+    break;
+  }
+}
+
+void narrowRow(const uint32_t *row, int width, uint8_t *out) {
+  for (int x = 0; x < width; x++) {
+    out[3 * x] = (row[x] >> 16) & 0xFF;
+    out[3 * x + 1] = (row[x] >> 8) & 0xFF;
+    out[3 * x + 2] = row[x] & 0xFF;
+  }
+}
+
+// Difference of two colors in YUV, with luma weighted the most. Only used
+// for comparisons, so it is left scaled up.
+int distance(uint32_t a, uint32_t b) {
+  int r = (int)((a >> 16) & 0xFF) - (int)((b >> 16) & 0xFF);
+  int g = (int)((a >> 8) & 0xFF) - (int)((b >> 8) & 0xFF);
+  int bl = (int)(a & 0xFF) - (int)(b & 0xFF);
+  int y = abs(299 * r + 587 * g + 114 * bl);
+  int u = abs(-169 * r - 331 * g + 500 * bl);
+  int v = abs(500 * r - 419 * g - 81 * bl);
+  return 48 * y + 7 * u + 6 * v;
+}
+
+uint32_t average(uint32_t a, uint32_t b) {
+  return (a & b) + (((a ^ b) & 0xFEFEFE) >> 1);
+}
+
+// xBR decides every corner of a pixel the same way, on its neighbourhood
+// turned so the corner faces (1, 1). With the neighbours named
+//       A1 B1 C1
+//    A0 A  B  C  C4
+//    D0 D  E  F  F4
+//    G0 G  H  I  I4
+//       G5 H5 I5
+// the corner is blended towards F or H when the edge between them is
+// stronger than the one between E and I.
+enum Neighbour { F, H, I, C, G, F4, H5, D, I5, I4, B, neighbourCount };
+constexpr int neighbourOffsets[neighbourCount][2] = {
+    {1, 0},  {0, 1}, {1, 1}, {1, -1}, {-1, 1}, {2, 0},
+    {0, 2}, {-1, 0}, {1, 2}, {2, 1},  {0, -1}};
+
+struct Corner {
+  int offsets[neighbourCount];
+};
+
+// The neighbourhood for the bottom right, bottom left, top left and top
+// right corner, each a quarter turn clockwise from the one before.
+std::array<Corner, 4> cornerOffsets(int stride) {
+  std::array<Corner, 4> corners;
+  for (int n = 0; n < neighbourCount; n++) {
+    int dx = neighbourOffsets[n][0], dy = neighbourOffsets[n][1];
+    for (Corner &corner : corners) {
+      corner.offsets[n] = dy * stride + dx;
+      int x = dx;
+      dx = -dy;
+      dy = x;
+    }
+  }
+  return corners;
+}
+
+uint32_t xbrCorner(const uint32_t *center, const Corner &corner) {
+  auto pixel = [&](Neighbour n) { return center[corner.offsets[n]]; };
+  uint32_t e = center[0], f = pixel(F), h = pixel(H);
+  if (e == f || e == h)
+    return e;
+
+  uint32_t i = pixel(I);
+  int edge = distance(e, pixel(C)) + distance(e, pixel(G)) +
+             distance(i, pixel(F4)) + distance(i, pixel(H5)) +
+             4 * distance(h, f);
+  int diagonal = distance(h, pixel(D)) + distance(h, pixel(I5)) +
+                 distance(f, pixel(I4)) + distance(f, pixel(B)) +
+                 4 * distance(e, i);
+  if (edge >= diagonal)
+    return e;
+  return average(e, distance(e, f) <= distance(e, h) ? f : h);
+}
+
+void xbrRow(const uint32_t *row, int stride, int width, uint32_t *out0,
+            uint32_t *out1) {
+  std::array<Corner, 4> corners = cornerOffsets(stride);
+  for (int x = 0; x < width; x++) {
+    out1[2 * x + 1] = xbrCorner(row + x, corners[0]);
+    out1[2 * x] = xbrCorner(row + x, corners[1]);
+    out0[2 * x] = xbrCorner(row + x, corners[2]);
+    out0[2 * x + 1] = xbrCorner(row + x, corners[3]);
+  }
+}
+
+} // namespace
+
+const char *scaleFilterName(ScaleFilter filter) {
+  switch (filter) {
+  case ScaleFilter::Nearest:
+    return "nearest";
+  case ScaleFilter::Scale2x:
+    return "scale2x";
+  case ScaleFilter::Scale3x:
+    return "scale3x";
+  case ScaleFilter::XBR:
+    return "xbr";
+  }
+  return "unknown";
+}
+
+bool parseScaleFilter(const std::string &spec, ScaleFilter &filter,
+                      int &factor) {
+  if (spec.rfind("nearest:", 0) == 0) {
+    char *end;
+    long value = strtol(spec.c_str() + 8, &end, 10);
+    if (spec.size() == 8 || *end != '\0' || value < 1 || value > 8)
+      return false;
+    filter = ScaleFilter::Nearest;
+    factor = value;
+    return true;
+  }
+
+  const struct {
+    ScaleFilter filter;
+    int factor;
+  } filters[] = {{ScaleFilter::Nearest, 2},
+                 {ScaleFilter::Scale2x, 2},
+                 {ScaleFilter::Scale3x, 3},
+                 {ScaleFilter::XBR, 2}};
+  for (const auto &candidate : filters) {
+    if (spec == scaleFilterName(candidate.filter)) {
+      filter = candidate.filter;
+      factor = candidate.factor;
+      return true;
+    }
+  }
+  return false;
+}
+
+Scaler::Scaler(ScaleFilter filter, int factor, int threads)
+    : filter(filter), factor(factor), pool(threads) {}
+
+void Scaler::scale(const uint8_t *pixels, int width, int height,
+                   PixelFormat format, const uint32_t shadeColors[4],
+                   uint8_t *out) {
+  // A few bands per thread, so threads that finish early can take over.
+  int bands = std::min(height, 4 * pool.size());
+  pool.run(bands, [&](int band) {
+    scaleBand(pixels, width, height, format, shadeColors,
+              height * band / bands, height * (band + 1) / bands, out);
+  });
+}
+
+void Scaler::scaleBand(const uint8_t *pixels, int width, int height,
+                       PixelFormat format, const uint32_t shadeColors[4],
+                       int first, int last, uint8_t *out) {
+  // The band's rows and the ones around it, widened to 0xRRGGBB with the
+  // edge pixels repeated into the padding.
+  int stride = width + 2 * padding;
+  thread_local std::vector<uint32_t> source;
+  thread_local std::vector<uint32_t> scaled;
+  source.resize((last - first + 2 * padding) * stride);
+  scaled.resize(3 * factor * width);
+
+  int sourceBytes = width * bytesPerPixel(format);
+  for (int y = first - padding; y < last + padding; y++) {
+    uint32_t *row = &source[(y - first + padding) * stride];
+    int clamped = std::clamp(y, 0, height - 1);
+    widenRow(pixels + clamped * sourceBytes, width, format, shadeColors,
+             row + padding);
+    std::fill(row, row + padding, row[padding]);
+    std::fill(row + padding + width, row + stride, row[padding + width - 1]);
+  }
+
+  int outWidth = factor * width;
+  for (int y = first; y < last; y++) {
+    const uint32_t *row = &source[(y - first + padding) * stride + padding];
+    uint32_t *rows[3] = {scaled.data(), scaled.data() + outWidth,
+                         scaled.data() + 2 * outWidth};
+    int rowCount = factor;
+
+    switch (filter) {
+    case ScaleFilter::Nearest:
+      // The other rows are the same, they are copied after converting.
+      simd::repeatPixels(row, width, factor, rows[0]);
+      rowCount = 1;
+      break;
+    case ScaleFilter::Scale2x:
+      simd::scale2xRow(row - stride, row, row + stride, width, rows[0],
+                       rows[1]);
+      break;
+    case ScaleFilter::Scale3x:
+      simd::scale3xRow(row - stride, row, row + stride, width, rows[0],
+                       rows[1], rows[2]);
+      break;
+    case ScaleFilter::XBR:
+      xbrRow(row, stride, width, rows[0], rows[1]);
+      break;
+    }
+
+    uint8_t *outRow = out + 3 * outWidth * factor * y;
+    for (int i = 0; i < rowCount; i++)
+      narrowRow(rows[i], outWidth, outRow + 3 * outWidth * i);
+    for (int i = rowCount; i < factor; i++)
+      memcpy(outRow + 3 * outWidth * i, outRow, 3 * outWidth);
+  }
+}
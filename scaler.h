@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "framebuffer.h"
+#include "threadpool.h"
+
+// Filters for scaling frames up on the CPU, for screenshots and recordings
+// on hosts without a GPU.
+enum class ScaleFilter : uint8_t {
+  Nearest, // Every pixel becomes a square, by any integer factor.
+  Scale2x, // Rounds off diagonal edges using only colors of the frame.
+  Scale3x, // The same at 3x.
+  XBR,     // 2x xBR level 1, blends along edges so it adds colors.
+};
+
+const char *scaleFilterName(ScaleFilter filter);
+// Takes "nearest", "nearest:N" with N from 1 to 8, "scale2x", "scale3x" or
+// "xbr", and sets the factor the filter scales by.
+bool parseScaleFilter(const std::string &spec, ScaleFilter &filter,
+                      int &factor);
+
+// Scales frames in any PixelFormat up to RGB888. Frames are split into bands
+// of rows that are scaled in parallel.
+class Scaler {
+  ScaleFilter filter;
+  int factor;
+  ThreadPool pool;
+
+  void scaleBand(const uint8_t *pixels, int width, int height,
+                 PixelFormat format, const uint32_t shadeColors[4], int first,
+                 int last, uint8_t *out);
+
+public:
+  Scaler(ScaleFilter filter, int factor, int threads = 0);
+
+  ScaleFilter getFilter() const { return filter; }
+  int getFactor() const { return factor; }
+
+  // shadeColors are the 0xRRGGBB colors of the shades in Indexed frames. out
+  // has to hold 3 * width * height * factor * factor bytes.
+  void scale(const uint8_t *pixels, int width, int height, PixelFormat format,
+             const uint32_t shadeColors[4], uint8_t *out);
+};
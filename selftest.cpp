@@ -0,0 +1,291 @@
+#include "selftest.h"
+
+#include "gb.h"
+#include "instructions.h"
+#include "ppu.h"
+#include "runahead.h"
+
+#include <cstdio>
+#include <initializer_list>
+#include <memory>
+#include <random>
+#include <vector>
+
+namespace {
+
+constexpr int cyclesPerFrame = 17556;
+constexpr uint64_t hashBasis = 1469598103934665603ull;
+constexpr uint64_t hashPrime = 1099511628211ull;
+
+// A DMG without a cartridge. Everything a check looks at, including the
+// hash of every drawn frame, is folded into trace, so two machines that
+// agree on it so far have behaved the same so far.
+struct Machine {
+  Bus bus;
+  CPU cpu{&bus};
+  PPU ppu{&bus};
+  uint64_t trace = hashBasis;
+  std::vector<uint64_t> frames;
+
+  Machine() {
+    bus.connectCPU(&cpu);
+    bus.connectPPU(&ppu);
+    ppu.setFrameHashHandler(
+        this,
+        [](void *machine, const FrameHash &hash) {
+          static_cast<Machine *>(machine)->record(hash.hash);
+          static_cast<Machine *>(machine)->frames.push_back(hash.hash);
+        },
+        false);
+  }
+
+  void record(uint64_t value) { trace = (trace ^ value) * hashPrime; }
+};
+
+// Something the CPU could do to the PPU. Reads are recorded.
+struct Access {
+  uint16_t addr;
+  uint8_t value;
+  bool write;
+};
+
+void apply(Machine &machine, const Access &access) {
+  if (access.write)
+    machine.cpu.write(access.addr, access.value);
+  else
+    machine.record(machine.cpu.read(access.addr));
+}
+
+Access randomAccess(std::mt19937 &rng) {
+  static const uint16_t registers[] = {0xFF40, 0xFF41, 0xFF42, 0xFF43,
+                                       0xFF45, 0xFF47, 0xFF48, 0xFF49,
+                                       0xFF4A, 0xFF4B};
+  switch (rng() % 8) {
+  case 0:
+    return {0xFF41, 0, false};
+  case 1:
+    return {0xFF44, 0, false};
+  case 2:
+    return {uint16_t(0x8000 + rng() % 0x2000), uint8_t(rng()), true};
+  case 3:
+    return {uint16_t(0xFE00 + rng() % 0xA0), uint8_t(rng()), true};
+  case 4:
+    return {0xFF0F, 0, true};
+  default: {
+    uint16_t addr = registers[rng() % 10];
+    uint8_t value = rng();
+    // The LCD is mostly left on, turning it off stops everything.
+    if (addr == 0xFF40 && rng() % 16)
+      value |= 0x80;
+    return {addr, value, true};
+  }
+  }
+}
+
+// Fills VRAM, OAM and the registers with the LCD off, then turns it on.
+void randomScene(std::mt19937 &rng, std::initializer_list<Machine *> machines) {
+  std::vector<Access> accesses;
+  accesses.push_back({0xFF40, 0, true});
+  for (uint16_t addr = 0x8000; addr < 0xA000; addr++)
+    accesses.push_back({addr, uint8_t(rng()), true});
+  // Sprites mostly on screen.
+  for (uint16_t addr = 0xFE00; addr < 0xFEA0; addr++)
+    accesses.push_back({addr, uint8_t(rng() % 176), true});
+  for (uint16_t addr : {0xFF41, 0xFF42, 0xFF43, 0xFF45, 0xFF47, 0xFF48, 0xFF49})
+    accesses.push_back({addr, uint8_t(rng()), true});
+  accesses.push_back({0xFF4A, uint8_t(rng() % 160), true});
+  accesses.push_back({0xFF4B, uint8_t(rng() % 176), true});
+  accesses.push_back({0xFF40, uint8_t(0x80 | rng()), true});
+  for (Machine *machine : machines)
+    for (const Access &access : accesses)
+      apply(*machine, access);
+}
+
+// Deferred PPU cycles against running every cycle as it is stepped. Random
+// register, VRAM and OAM traffic lands on arbitrary dots, and STAT, LY, IF
+// and the frames have to match on every cycle, in both engines.
+bool checkCatchUp(int seed) {
+  for (PPUEngine engine : {PPUEngine::Scanline, PPUEngine::Fifo}) {
+    std::mt19937 rng(seed);
+    auto deferred = std::make_unique<Machine>();
+    auto reference = std::make_unique<Machine>();
+    reference->ppu.setDeferCycles(false);
+    Machine *machines[2] = {deferred.get(), reference.get()};
+    for (Machine *machine : machines)
+      machine->ppu.setEngine(engine);
+    randomScene(rng, {deferred.get(), reference.get()});
+
+    Access last = {0, 0, false};
+    for (int cycle = 0; cycle < 3 * cyclesPerFrame; cycle++) {
+      bool accessing = rng() % 32 == 0;
+      Access access = accessing ? randomAccess(rng) : Access{};
+      for (Machine *machine : machines) {
+        machine->ppu.step();
+        if (accessing)
+          apply(*machine, access);
+        machine->record(machine->cpu.read(0xFF0F));
+      }
+      if (accessing)
+        last = access;
+      if (deferred->trace != reference->trace) {
+        printf("  seed %d, %s engine: differs on cycle %d (LY %d, LX %d), "
+               "last access %s %04X\n",
+               seed, ppuEngineName(engine), cycle, reference->ppu.getLY(),
+               reference->ppu.getLX(), last.write ? "write" : "read",
+               last.addr);
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+// The FIFO engine against the scanline one. Without mid-line changes they
+// have to draw the same frames, only mode 3 can be longer in the FIFO one.
+bool checkEngines(int seed) {
+  std::mt19937 rng(seed);
+  auto scanline = std::make_unique<Machine>();
+  auto fifo = std::make_unique<Machine>();
+  fifo->ppu.setEngine(PPUEngine::Fifo);
+  Machine *machines[2] = {scanline.get(), fifo.get()};
+  randomScene(rng, {scanline.get(), fifo.get()});
+
+  for (Machine *machine : machines)
+    for (int cycle = 0; cycle < 2 * cyclesPerFrame; cycle++)
+      machine->ppu.step();
+  if (scanline->trace != fifo->trace) {
+    printf("  seed %d: the frames differ\n", seed);
+    return false;
+  }
+  return true;
+}
+
+// The tile cache, which decodes a tile again only after a write changed it,
+// against a cache that starts out with everything to decode. VRAM is
+// rewritten while frames are drawn, then a new machine gets the same memory
+// and registers, and both have to draw the same next frame.
+bool checkTileCache(int seed) {
+  std::mt19937 rng(seed);
+  auto cached = std::make_unique<Machine>();
+  randomScene(rng, {cached.get()});
+  for (int cycle = 0; cycle < 3 * cyclesPerFrame; cycle++) {
+    cached->ppu.step();
+    if (rng() % 8)
+      continue;
+    // Mostly tile data, sometimes a byte that does not change.
+    uint16_t addr = 0x8000 + rng() % (rng() % 4 ? 0x1800 : 0x2000);
+    uint8_t value = rng() % 4 ? uint8_t(rng()) : cached->cpu.read(addr);
+    cached->cpu.write(addr, value);
+  }
+  while (cached->ppu.getLY() != 0 || cached->ppu.getLX() != 0)
+    cached->ppu.step();
+
+  auto fresh = std::make_unique<Machine>();
+  fresh->cpu.write(0xFF40, 0);
+  for (uint16_t addr = 0x8000; addr < 0xA000; addr++)
+    fresh->cpu.write(addr, cached->cpu.read(addr));
+  for (uint16_t addr = 0xFE00; addr < 0xFEA0; addr++)
+    fresh->cpu.write(addr, cached->cpu.read(addr));
+  for (uint16_t addr = 0xFF41; addr <= 0xFF4B; addr++)
+    if (addr != 0xFF44 && addr != 0xFF46)
+      fresh->cpu.write(addr, cached->cpu.read(addr));
+  fresh->cpu.write(0xFF40, cached->cpu.read(0xFF40));
+
+  cached->trace = hashBasis;
+  for (Machine *machine : {cached.get(), fresh.get()})
+    for (int cycle = 0; cycle < cyclesPerFrame; cycle++)
+      machine->ppu.step();
+  if (cached->trace != fresh->trace) {
+    printf("  seed %d: the frames differ\n", seed);
+    return false;
+  }
+  return true;
+}
+
+// Run-ahead against running normally. A program in HRAM scrolls the
+// background by a random step every few cycles, so every frame differs, and
+// with N frames of run-ahead every frame shown has to be the one shown N
+// frames later without it.
+bool checkRunAhead(int seed) {
+  constexpr int frames = 4;
+  // INC A; LDH (SCX),A; ADD A,C; LDH (SCY),A; JR -8
+  static const uint8_t program[] = {0x3C, 0xE0, 0x43, 0x81,
+                                    0xE0, 0x42, 0x18, 0xF8};
+  for (PPUEngine engine : {PPUEngine::Scanline, PPUEngine::Fifo}) {
+    std::mt19937 rng(seed);
+    uint8_t step = rng();
+    int ahead = 1 + rng() % 3;
+    auto normal = std::make_unique<Machine>();
+    auto speculating = std::make_unique<Machine>();
+    randomScene(rng, {normal.get(), speculating.get()});
+    for (Machine *machine : {normal.get(), speculating.get()}) {
+      machine->ppu.setEngine(engine);
+      // The background has to be on for scrolling to show.
+      machine->cpu.write(0xFF40, machine->cpu.read(0xFF40) | 1);
+      for (int i = 0; i < int(sizeof(program)); i++)
+        machine->cpu.write(0xFF80 + i, program[i]);
+      machine->cpu.getRegisters().pc = 0xFF80;
+      machine->cpu.getRegisters().c = step;
+    }
+
+    RunAhead runAhead(speculating->cpu, speculating->bus, speculating->ppu,
+                      ahead);
+    for (Machine *machine : {normal.get(), speculating.get()}) {
+      Joypad &joypad = machine->bus.getJoypad();
+      joypad.startFrame();
+      int real = machine == normal.get() ? frames + ahead : frames;
+      for (int frame = 0; frame < real; frame++) {
+        for (int cycle = 0; cycle < cyclesPerFrame; cycle++) {
+          machine->ppu.step();
+          joypad.step();
+          machine->cpu.step();
+        }
+        joypad.startFrame();
+        if (machine == speculating.get())
+          runAhead.speculate();
+      }
+    }
+
+    const std::vector<uint64_t> &shown = speculating->frames;
+    bool shifted = shown.size() == frames &&
+                   normal->frames.size() == size_t(frames + ahead);
+    for (size_t i = 0; shifted && i < shown.size(); i++)
+      shifted = shown[i] == normal->frames[i + ahead];
+    if (!shifted) {
+      printf("  seed %d, %s engine: %d frames ahead, %zu frames shown of "
+             "%zu, not shifted by %d\n",
+             seed, ppuEngineName(engine), ahead, shown.size(),
+             normal->frames.size(), ahead);
+      return false;
+    }
+  }
+  return true;
+}
+
+struct Check {
+  const char *name;
+  bool (*run)(int seed);
+};
+
+const Check checks[] = {
+    {"deferred PPU cycles match per-cycle", checkCatchUp},
+    {"FIFO and scanline engines draw the same frames", checkEngines},
+    {"tile cache draws the same frames as decoding afresh", checkTileCache},
+    {"run-ahead shows the frames N frames early", checkRunAhead},
+};
+
+} // namespace
+
+bool runSelfTest(int seeds) {
+  bool passed = true;
+  for (const Check &check : checks) {
+    int failures = 0;
+    for (int seed = 0; seed < seeds; seed++)
+      if (!check.run(seed))
+        failures++;
+    printf("%s: %s (%d of %d seeds failed)\n", check.name,
+           failures ? "FAILED" : "ok", failures, seeds);
+    passed = passed && failures == 0;
+  }
+  return passed;
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+// Checks the emulator against itself, without a ROM or a window. Every
+// check runs two machines on the same randomised traffic, one of them along
+// a path that is slow but obviously right, and they have to agree. Run with
+// --self-test after changing the PPU's timing or drawing.
+//
+// Prints a line per check, and where the machines first disagreed for every
+// seed that failed. Returns whether everything passed.
+bool runSelfTest(int seeds = 200);
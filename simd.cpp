@@ -0,0 +1,486 @@
+#include "simd.h"
+
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SIMD_X86
+#endif
+
+namespace simd {
+
+namespace {
+
+// Bit n of a byte spread out to byte 7 - n (or n when mirrored) of a word.
+struct ExpandTable {
+  uint64_t normal[256];
+  uint64_t mirrored[256];
+
+  ExpandTable() {
+    for (int value = 0; value < 256; value++) {
+      normal[value] = 0;
+      mirrored[value] = 0;
+      for (int x = 0; x < 8; x++) {
+        uint64_t bit = (value >> (7 - x)) & 1;
+        normal[value] |= bit << (8 * x);
+        mirrored[value] |= bit << (8 * (7 - x));
+      }
+    }
+  }
+};
+
+const ExpandTable expandTable;
+
+void decodeTileRowsScalar(const uint8_t *planes, int rows, uint8_t *out,
+                          uint8_t *mirrored) {
+  for (int y = 0; y < rows; y++) {
+    uint8_t low = planes[2 * y];
+    uint8_t high = planes[2 * y + 1];
+    uint64_t row = expandTable.normal[low] | (expandTable.normal[high] << 1);
+    uint64_t mirroredRow =
+        expandTable.mirrored[low] | (expandTable.mirrored[high] << 1);
+    memcpy(out + 8 * y, &row, 8);
+    memcpy(mirrored + 8 * y, &mirroredRow, 8);
+  }
+}
+
+void mapPaletteScalar(const uint8_t *indices, int count, const uint8_t table[4],
+                      uint8_t *out) {
+  for (int i = 0; i < count; i++)
+    out[i] = table[indices[i]];
+}
+
+// Scale2x and Scale3x name the neighbours of the source pixel E as
+//   A B C
+//   D E F
+//   G H I
+// and only copy a neighbour into a corner if it continues an edge there.
+void scale2xRowScalar(const uint32_t *above, const uint32_t *row,
+                      const uint32_t *below, int width, uint32_t *out0,
+                      uint32_t *out1) {
+  for (int x = 0; x < width; x++) {
+    uint32_t B = above[x], D = row[x - 1], E = row[x], F = row[x + 1];
+    uint32_t H = below[x];
+    bool edge = B != H && D != F;
+    out0[2 * x] = edge && D == B ? D : E;
+    out0[2 * x + 1] = edge && B == F ? F : E;
+    out1[2 * x] = edge && D == H ? D : E;
+    out1[2 * x + 1] = edge && H == F ? F : E;
+  }
+}
+
+void scale3xRowScalar(const uint32_t *above, const uint32_t *row,
+                      const uint32_t *below, int width, uint32_t *out0,
+                      uint32_t *out1, uint32_t *out2) {
+  for (int x = 0; x < width; x++) {
+    uint32_t A = above[x - 1], B = above[x], C = above[x + 1];
+    uint32_t D = row[x - 1], E = row[x], F = row[x + 1];
+    uint32_t G = below[x - 1], H = below[x], I = below[x + 1];
+    bool edge = B != H && D != F;
+    bool db = edge && D == B, bf = edge && B == F;
+    bool dh = edge && D == H, hf = edge && H == F;
+    out0[3 * x] = db ? D : E;
+    out0[3 * x + 1] = (db && E != C) || (bf && E != A) ? B : E;
+    out0[3 * x + 2] = bf ? F : E;
+    out1[3 * x] = (db && E != G) || (dh && E != A) ? D : E;
+    out1[3 * x + 1] = E;
+    out1[3 * x + 2] = (bf && E != I) || (hf && E != C) ? F : E;
+    out2[3 * x] = dh ? D : E;
+    out2[3 * x + 1] = (dh && E != I) || (hf && E != G) ? H : E;
+    out2[3 * x + 2] = hf ? F : E;
+  }
+}
+
+void repeatPixelsScalar(const uint32_t *row, int width, int factor,
+                        uint32_t *out) {
+  for (int x = 0; x < width; x++)
+    for (int i = 0; i < factor; i++)
+      out[factor * x + i] = row[x];
+}
+
+#ifdef SIMD_X86
+
+constexpr uint64_t broadcast = 0x0101010101010101ull;
+
+// Two rows per 128 bit vector: every byte of a row gets a copy of the plane
+// byte, and is compared against the single bit that pixel uses.
+__attribute__((target("sse2"))) void
+decodeTileRowsSSE2(const uint8_t *planes, int rows, uint8_t *out,
+                   uint8_t *mirrored) {
+  const __m128i bits = _mm_set1_epi64x(0x0102040810204080ll);
+  const __m128i mirroredBits = _mm_set1_epi64x(0x8040201008040201ll);
+  const __m128i one = _mm_set1_epi8(1);
+  const __m128i two = _mm_set1_epi8(2);
+
+  int y = 0;
+  for (; y + 2 <= rows; y += 2) {
+    __m128i low = _mm_set_epi64x(planes[2 * y + 2] * broadcast,
+                                 planes[2 * y] * broadcast);
+    __m128i high = _mm_set_epi64x(planes[2 * y + 3] * broadcast,
+                                  planes[2 * y + 1] * broadcast);
+
+    __m128i row = _mm_or_si128(
+        _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(low, bits), bits), one),
+        _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(high, bits), bits), two));
+    __m128i mirroredRow = _mm_or_si128(
+        _mm_and_si128(
+            _mm_cmpeq_epi8(_mm_and_si128(low, mirroredBits), mirroredBits),
+            one),
+        _mm_and_si128(
+            _mm_cmpeq_epi8(_mm_and_si128(high, mirroredBits), mirroredBits),
+            two));
+
+    _mm_storeu_si128((__m128i *)(out + 8 * y), row);
+    _mm_storeu_si128((__m128i *)(mirrored + 8 * y), mirroredRow);
+  }
+  if (y < rows)
+    decodeTileRowsScalar(planes + 2 * y, rows - y, out + 8 * y,
+                         mirrored + 8 * y);
+}
+
+__attribute__((target("avx2"))) void
+decodeTileRowsAVX2(const uint8_t *planes, int rows, uint8_t *out,
+                   uint8_t *mirrored) {
+  const __m256i bits = _mm256_set1_epi64x(0x0102040810204080ll);
+  const __m256i mirroredBits = _mm256_set1_epi64x(0x8040201008040201ll);
+  const __m256i one = _mm256_set1_epi8(1);
+  const __m256i two = _mm256_set1_epi8(2);
+
+  int y = 0;
+  for (; y + 4 <= rows; y += 4) {
+    __m256i low = _mm256_set_epi64x(
+        planes[2 * y + 6] * broadcast, planes[2 * y + 4] * broadcast,
+        planes[2 * y + 2] * broadcast, planes[2 * y] * broadcast);
+    __m256i high = _mm256_set_epi64x(
+        planes[2 * y + 7] * broadcast, planes[2 * y + 5] * broadcast,
+        planes[2 * y + 3] * broadcast, planes[2 * y + 1] * broadcast);
+
+    __m256i row = _mm256_or_si256(
+        _mm256_and_si256(
+            _mm256_cmpeq_epi8(_mm256_and_si256(low, bits), bits), one),
+        _mm256_and_si256(
+            _mm256_cmpeq_epi8(_mm256_and_si256(high, bits), bits), two));
+    __m256i mirroredRow = _mm256_or_si256(
+        _mm256_and_si256(_mm256_cmpeq_epi8(
+                             _mm256_and_si256(low, mirroredBits), mirroredBits),
+                         one),
+        _mm256_and_si256(
+            _mm256_cmpeq_epi8(_mm256_and_si256(high, mirroredBits),
+                              mirroredBits),
+            two));
+
+    _mm256_storeu_si256((__m256i *)(out + 8 * y), row);
+    _mm256_storeu_si256((__m256i *)(mirrored + 8 * y), mirroredRow);
+  }
+  if (y < rows)
+    decodeTileRowsSSE2(planes + 2 * y, rows - y, out + 8 * y, mirrored + 8 * y);
+}
+
+__attribute__((target("ssse3"))) void
+mapPaletteSSSE3(const uint8_t *indices, int count, const uint8_t table[4],
+                uint8_t *out) {
+  const __m128i lookup = _mm_setr_epi8(table[0], table[1], table[2], table[3],
+                                       0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+  int i = 0;
+  for (; i + 16 <= count; i += 16) {
+    __m128i colors = _mm_loadu_si128((const __m128i *)(indices + i));
+    _mm_storeu_si128((__m128i *)(out + i), _mm_shuffle_epi8(lookup, colors));
+  }
+  mapPaletteScalar(indices + i, count - i, table, out + i);
+}
+
+__attribute__((target("avx2"))) void
+mapPaletteAVX2(const uint8_t *indices, int count, const uint8_t table[4],
+               uint8_t *out) {
+  const __m256i lookup = _mm256_setr_epi8(
+      table[0], table[1], table[2], table[3], 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+      0, table[0], table[1], table[2], table[3], 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+      0, 0);
+  int i = 0;
+  for (; i + 32 <= count; i += 32) {
+    __m256i colors = _mm256_loadu_si256((const __m256i *)(indices + i));
+    _mm256_storeu_si256((__m256i *)(out + i),
+                        _mm256_shuffle_epi8(lookup, colors));
+  }
+  mapPaletteSSSE3(indices + i, count - i, table, out + i);
+}
+
+__attribute__((target("sse2"))) inline __m128i
+select128(__m128i mask, __m128i a, __m128i b) {
+  return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+// Stores a0 b0 c0 a1 b1 c1 a2 b2 c2 a3 b3 c3.
+__attribute__((target("sse2"))) inline void
+store3(uint32_t *out, __m128i a, __m128i b, __m128i c) {
+  __m128 ab = _mm_castsi128_ps(_mm_unpacklo_epi32(a, b));
+  __m128 ca = _mm_castsi128_ps(_mm_unpacklo_epi32(c, a));
+  __m128 bc = _mm_castsi128_ps(_mm_unpacklo_epi32(b, c));
+  __m128 abHigh = _mm_castsi128_ps(_mm_unpackhi_epi32(a, b));
+  __m128 caHigh = _mm_castsi128_ps(_mm_unpackhi_epi32(c, a));
+  __m128 bcHigh = _mm_castsi128_ps(_mm_unpackhi_epi32(b, c));
+  _mm_storeu_ps((float *)out, _mm_shuffle_ps(ab, ca, _MM_SHUFFLE(3, 0, 1, 0)));
+  _mm_storeu_ps((float *)out + 4,
+                _mm_shuffle_ps(bc, abHigh, _MM_SHUFFLE(1, 0, 3, 2)));
+  _mm_storeu_ps((float *)out + 8,
+                _mm_shuffle_ps(caHigh, bcHigh, _MM_SHUFFLE(3, 2, 3, 0)));
+}
+
+// Four pixels at a time, all corners are computed and picked with masks.
+__attribute__((target("sse2"))) void
+scale2xRowSSE2(const uint32_t *above, const uint32_t *row,
+               const uint32_t *below, int width, uint32_t *out0,
+               uint32_t *out1) {
+  const __m128i ones = _mm_set1_epi32(-1);
+  int x = 0;
+  for (; x + 4 <= width; x += 4) {
+    __m128i B = _mm_loadu_si128((const __m128i *)(above + x));
+    __m128i D = _mm_loadu_si128((const __m128i *)(row + x - 1));
+    __m128i E = _mm_loadu_si128((const __m128i *)(row + x));
+    __m128i F = _mm_loadu_si128((const __m128i *)(row + x + 1));
+    __m128i H = _mm_loadu_si128((const __m128i *)(below + x));
+
+    __m128i edge = _mm_andnot_si128(
+        _mm_cmpeq_epi32(B, H), _mm_andnot_si128(_mm_cmpeq_epi32(D, F), ones));
+    __m128i e0 = select128(_mm_and_si128(edge, _mm_cmpeq_epi32(D, B)), D, E);
+    __m128i e1 = select128(_mm_and_si128(edge, _mm_cmpeq_epi32(B, F)), F, E);
+    __m128i e2 = select128(_mm_and_si128(edge, _mm_cmpeq_epi32(D, H)), D, E);
+    __m128i e3 = select128(_mm_and_si128(edge, _mm_cmpeq_epi32(H, F)), F, E);
+
+    _mm_storeu_si128((__m128i *)(out0 + 2 * x), _mm_unpacklo_epi32(e0, e1));
+    _mm_storeu_si128((__m128i *)(out0 + 2 * x + 4), _mm_unpackhi_epi32(e0, e1));
+    _mm_storeu_si128((__m128i *)(out1 + 2 * x), _mm_unpacklo_epi32(e2, e3));
+    _mm_storeu_si128((__m128i *)(out1 + 2 * x + 4), _mm_unpackhi_epi32(e2, e3));
+  }
+  if (x < width)
+    scale2xRowScalar(above + x, row + x, below + x, width - x, out0 + 2 * x,
+                     out1 + 2 * x);
+}
+
+__attribute__((target("sse2"))) void
+scale3xRowSSE2(const uint32_t *above, const uint32_t *row,
+               const uint32_t *below, int width, uint32_t *out0,
+               uint32_t *out1, uint32_t *out2) {
+  const __m128i ones = _mm_set1_epi32(-1);
+  int x = 0;
+  for (; x + 4 <= width; x += 4) {
+    __m128i A = _mm_loadu_si128((const __m128i *)(above + x - 1));
+    __m128i B = _mm_loadu_si128((const __m128i *)(above + x));
+    __m128i C = _mm_loadu_si128((const __m128i *)(above + x + 1));
+    __m128i D = _mm_loadu_si128((const __m128i *)(row + x - 1));
+    __m128i E = _mm_loadu_si128((const __m128i *)(row + x));
+    __m128i F = _mm_loadu_si128((const __m128i *)(row + x + 1));
+    __m128i G = _mm_loadu_si128((const __m128i *)(below + x - 1));
+    __m128i H = _mm_loadu_si128((const __m128i *)(below + x));
+    __m128i I = _mm_loadu_si128((const __m128i *)(below + x + 1));
+
+    __m128i edge = _mm_andnot_si128(
+        _mm_cmpeq_epi32(B, H), _mm_andnot_si128(_mm_cmpeq_epi32(D, F), ones));
+    __m128i db = _mm_and_si128(edge, _mm_cmpeq_epi32(D, B));
+    __m128i bf = _mm_and_si128(edge, _mm_cmpeq_epi32(B, F));
+    __m128i dh = _mm_and_si128(edge, _mm_cmpeq_epi32(D, H));
+    __m128i hf = _mm_and_si128(edge, _mm_cmpeq_epi32(H, F));
+    __m128i ea = _mm_cmpeq_epi32(E, A);
+    __m128i ec = _mm_cmpeq_epi32(E, C);
+    __m128i eg = _mm_cmpeq_epi32(E, G);
+    __m128i ei = _mm_cmpeq_epi32(E, I);
+
+    __m128i e0 = select128(db, D, E);
+    __m128i e1 = select128(
+        _mm_or_si128(_mm_andnot_si128(ec, db), _mm_andnot_si128(ea, bf)), B,
+        E);
+    __m128i e2 = select128(bf, F, E);
+    __m128i e3 = select128(
+        _mm_or_si128(_mm_andnot_si128(eg, db), _mm_andnot_si128(ea, dh)), D,
+        E);
+    __m128i e5 = select128(
+        _mm_or_si128(_mm_andnot_si128(ei, bf), _mm_andnot_si128(ec, hf)), F,
+        E);
+    __m128i e6 = select128(dh, D, E);
+    __m128i e7 = select128(
+        _mm_or_si128(_mm_andnot_si128(ei, dh), _mm_andnot_si128(eg, hf)), H,
+        E);
+    __m128i e8 = select128(hf, F, E);
+
+    store3(out0 + 3 * x, e0, e1, e2);
+    store3(out1 + 3 * x, e3, E, e5);
+    store3(out2 + 3 * x, e6, e7, e8);
+  }
+  if (x < width)
+    scale3xRowScalar(above + x, row + x, below + x, width - x, out0 + 3 * x,
+                     out1 + 3 * x, out2 + 3 * x);
+}
+
+__attribute__((target("sse2"))) void
+repeatPixelsSSE2(const uint32_t *row, int width, int factor, uint32_t *out) {
+  if (factor < 2 || factor > 4)
+    return repeatPixelsScalar(row, width, factor, out);
+
+  int x = 0;
+  for (; x + 4 <= width; x += 4) {
+    __m128i pixels = _mm_loadu_si128((const __m128i *)(row + x));
+    uint32_t *dst = out + factor * x;
+    if (factor == 2) {
+      _mm_storeu_si128((__m128i *)dst, _mm_unpacklo_epi32(pixels, pixels));
+      _mm_storeu_si128((__m128i *)(dst + 4),
+                       _mm_unpackhi_epi32(pixels, pixels));
+    } else if (factor == 3) {
+      store3(dst, pixels, pixels, pixels);
+    } else {
+      _mm_storeu_si128((__m128i *)dst, _mm_shuffle_epi32(pixels, 0x00));
+      _mm_storeu_si128((__m128i *)(dst + 4), _mm_shuffle_epi32(pixels, 0x55));
+      _mm_storeu_si128((__m128i *)(dst + 8), _mm_shuffle_epi32(pixels, 0xAA));
+      _mm_storeu_si128((__m128i *)(dst + 12), _mm_shuffle_epi32(pixels, 0xFF));
+    }
+  }
+  repeatPixelsScalar(row + x, width - x, factor, out + factor * x);
+}
+
+// Unpacking works within 128 bit lanes, so the halves are put back in order
+// when storing.
+__attribute__((target("avx2"))) void
+scale2xRowAVX2(const uint32_t *above, const uint32_t *row,
+               const uint32_t *below, int width, uint32_t *out0,
+               uint32_t *out1) {
+  const __m256i ones = _mm256_set1_epi32(-1);
+  int x = 0;
+  for (; x + 8 <= width; x += 8) {
+    __m256i B = _mm256_loadu_si256((const __m256i *)(above + x));
+    __m256i D = _mm256_loadu_si256((const __m256i *)(row + x - 1));
+    __m256i E = _mm256_loadu_si256((const __m256i *)(row + x));
+    __m256i F = _mm256_loadu_si256((const __m256i *)(row + x + 1));
+    __m256i H = _mm256_loadu_si256((const __m256i *)(below + x));
+
+    __m256i edge = _mm256_andnot_si256(
+        _mm256_cmpeq_epi32(B, H),
+        _mm256_andnot_si256(_mm256_cmpeq_epi32(D, F), ones));
+    __m256i e0 = _mm256_blendv_epi8(
+        E, D, _mm256_and_si256(edge, _mm256_cmpeq_epi32(D, B)));
+    __m256i e1 = _mm256_blendv_epi8(
+        E, F, _mm256_and_si256(edge, _mm256_cmpeq_epi32(B, F)));
+    __m256i e2 = _mm256_blendv_epi8(
+        E, D, _mm256_and_si256(edge, _mm256_cmpeq_epi32(D, H)));
+    __m256i e3 = _mm256_blendv_epi8(
+        E, F, _mm256_and_si256(edge, _mm256_cmpeq_epi32(H, F)));
+
+    __m256i low = _mm256_unpacklo_epi32(e0, e1);
+    __m256i high = _mm256_unpackhi_epi32(e0, e1);
+    _mm256_storeu_si256((__m256i *)(out0 + 2 * x),
+                        _mm256_permute2x128_si256(low, high, 0x20));
+    _mm256_storeu_si256((__m256i *)(out0 + 2 * x + 8),
+                        _mm256_permute2x128_si256(low, high, 0x31));
+    low = _mm256_unpacklo_epi32(e2, e3);
+    high = _mm256_unpackhi_epi32(e2, e3);
+    _mm256_storeu_si256((__m256i *)(out1 + 2 * x),
+                        _mm256_permute2x128_si256(low, high, 0x20));
+    _mm256_storeu_si256((__m256i *)(out1 + 2 * x + 8),
+                        _mm256_permute2x128_si256(low, high, 0x31));
+  }
+  if (x < width)
+    scale2xRowSSE2(above + x, row + x, below + x, width - x, out0 + 2 * x,
+                   out1 + 2 * x);
+}
+
+#endif
+
+struct Kernels {
+  const char *name;
+  void (*decodeTileRows)(const uint8_t *, int, uint8_t *, uint8_t *);
+  void (*mapPalette)(const uint8_t *, int, const uint8_t[4], uint8_t *);
+  void (*scale2xRow)(const uint32_t *, const uint32_t *, const uint32_t *, int,
+                     uint32_t *, uint32_t *);
+  void (*scale3xRow)(const uint32_t *, const uint32_t *, const uint32_t *, int,
+                     uint32_t *, uint32_t *, uint32_t *);
+  void (*repeatPixels)(const uint32_t *, int, int, uint32_t *);
+};
+
+const Kernels scalar = {"scalar", decodeTileRowsScalar, mapPaletteScalar,
+                        scale2xRowScalar, scale3xRowScalar, repeatPixelsScalar};
+#ifdef SIMD_X86
+const Kernels sse2 = {"sse2", decodeTileRowsSSE2, mapPaletteScalar,
+                      scale2xRowSSE2, scale3xRowSSE2, repeatPixelsSSE2};
+const Kernels ssse3 = {"ssse3", decodeTileRowsSSE2, mapPaletteSSSE3,
+                       scale2xRowSSE2, scale3xRowSSE2, repeatPixelsSSE2};
+// 3x output does not line up with 256 bit vectors, so Scale3x and repeating
+// pixels stay on SSE2.
+const Kernels avx2 = {"avx2", decodeTileRowsAVX2, mapPaletteAVX2,
+                      scale2xRowAVX2, scale3xRowSSE2, repeatPixelsSSE2};
+#endif
+
+bool isSupported(const Kernels &kernels) {
+#ifdef SIMD_X86
+  if (&kernels == &avx2)
+    return __builtin_cpu_supports("avx2");
+  if (&kernels == &ssse3)
+    return __builtin_cpu_supports("ssse3");
+  if (&kernels == &sse2)
+    return __builtin_cpu_supports("sse2");
+#endif
+  return &kernels == &scalar;
+}
+
+const Kernels *detect() {
+#ifdef SIMD_X86
+  __builtin_cpu_init();
+  for (const Kernels *kernels : {&avx2, &ssse3, &sse2})
+    if (isSupported(*kernels))
+      return kernels;
+#endif
+  return &scalar;
+}
+
+const Kernels *active = detect();
+
+} // namespace
+
+void decodeTileRows(const uint8_t *planes, int rows, uint8_t *out,
+                    uint8_t *mirrored) {
+  active->decodeTileRows(planes, rows, out, mirrored);
+}
+
+void mapPalette(const uint8_t *indices, int count, const uint8_t table[4],
+                uint8_t *out) {
+  active->mapPalette(indices, count, table, out);
+}
+
+void scale2xRow(const uint32_t *above, const uint32_t *row,
+                const uint32_t *below, int width, uint32_t *out0,
+                uint32_t *out1) {
+  active->scale2xRow(above, row, below, width, out0, out1);
+}
+
+void scale3xRow(const uint32_t *above, const uint32_t *row,
+                const uint32_t *below, int width, uint32_t *out0,
+                uint32_t *out1, uint32_t *out2) {
+  active->scale3xRow(above, row, below, width, out0, out1, out2);
+}
+
+void repeatPixels(const uint32_t *row, int width, int factor, uint32_t *out) {
+  active->repeatPixels(row, width, factor, out);
+}
+
+const char *implementation() { return active->name; }
+
+bool setImplementation(const std::string &name) {
+  if (name == "auto") {
+    active = detect();
+    return true;
+  }
+  const Kernels *all[] = {
+      &scalar,
+#ifdef SIMD_X86
+      &sse2,
+      &ssse3,
+      &avx2,
+#endif
+  };
+  for (const Kernels *kernels : all) {
+    if (name == kernels->name && isSupported(*kernels)) {
+      active = kernels;
+      return true;
+    }
+  }
+  return false;
+}
+
+} // namespace simd
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// Vectorized kernels for the line renderer and the frame scalers. The best
+// implementation the CPU supports is picked at startup, with a plain C++
+// fallback for everything else.
+namespace simd {
+
+// Expands rows of 2bpp tile data, stored as (low plane, high plane) byte
+// pairs, to one color index per byte. mirrored receives the same rows
+// flipped horizontally.
+void decodeTileRows(const uint8_t *planes, int rows, uint8_t *out,
+                    uint8_t *mirrored);
+
+// out[i] = table[indices[i]] for indices in the range 0-3.
+void mapPalette(const uint8_t *indices, int count, const uint8_t table[4],
+                uint8_t *out);
+
+// The scaler kernels work on rows of 32 bit pixels that can be read one pixel
+// past both ends, above and below being the neighbouring source rows.
+
+// Scale2x: each pixel becomes 2x2, writing 2 * width pixels to out0 and out1.
+void scale2xRow(const uint32_t *above, const uint32_t *row,
+                const uint32_t *below, int width, uint32_t *out0,
+                uint32_t *out1);
+// Scale3x: each pixel becomes 3x3, writing 3 * width pixels to each row.
+void scale3xRow(const uint32_t *above, const uint32_t *row,
+                const uint32_t *below, int width, uint32_t *out0,
+                uint32_t *out1, uint32_t *out2);
+// Repeats every pixel factor times, writing factor * width pixels.
+void repeatPixels(const uint32_t *row, int width, int factor, uint32_t *out);
+
+// One of "avx2", "ssse3", "sse2" or "scalar".
+const char *implementation();
+// Forces a specific implementation, returns false if it is unknown or not
+// supported by this CPU.
+bool setImplementation(const std::string &name);
+
+} // namespace simd
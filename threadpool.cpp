@@ -0,0 +1,63 @@
+#include "threadpool.h"
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(int threads) {
+  if (threads <= 0)
+    threads = std::max<int>(std::thread::hardware_concurrency(), 1);
+  for (int i = 1; i < threads; i++)
+    this->threads.emplace_back(&ThreadPool::loop, this);
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    stopping = true;
+  }
+  wakeUp.notify_all();
+  for (std::thread &thread : threads)
+    thread.join();
+}
+
+void ThreadPool::run(int tasks, const std::function<void(int)> &task) {
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    job = &task;
+    taskCount = tasks;
+    nextTask = 0;
+    busyThreads = threads.size();
+    generation++;
+  }
+  wakeUp.notify_all();
+
+  work();
+
+  // Threads still finishing a task use it, so wait for all of them.
+  std::unique_lock<std::mutex> lock(mtx);
+  finished.wait(lock, [&] { return busyThreads == 0; });
+  job = nullptr;
+}
+
+void ThreadPool::work() {
+  for (int task = nextTask++; task < taskCount; task = nextTask++)
+    (*job)(task);
+}
+
+void ThreadPool::loop() {
+  uint64_t done = 0;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(mtx);
+      wakeUp.wait(lock, [&] { return stopping || generation != done; });
+      if (stopping)
+        return;
+      done = generation;
+    }
+
+    work();
+
+    std::lock_guard<std::mutex> lock(mtx);
+    if (--busyThreads == 0)
+      finished.notify_one();
+  }
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed set of threads that split a job of numbered tasks between them.
+// The thread calling run() works on the tasks too, so a pool without extra
+// threads simply runs everything inline.
+class ThreadPool {
+  std::vector<std::thread> threads;
+
+  std::mutex mtx;
+  std::condition_variable wakeUp;
+  std::condition_variable finished;
+  // Bumped for every job, so a thread knows it has not worked on it yet.
+  uint64_t generation = 0;
+  bool stopping = false;
+  int busyThreads = 0;
+
+  const std::function<void(int)> *job = nullptr;
+  int taskCount = 0;
+  std::atomic<int> nextTask{0};
+
+  void work();
+  void loop();
+
+public:
+  // Runs jobs on this many threads including the caller, or on one thread
+  // per core for 0.
+  explicit ThreadPool(int threads = 0);
+  ~ThreadPool();
+
+  // Threads working on a job, including the caller.
+  int size() const { return threads.size() + 1; }
+
+  // Calls task(0) to task(tasks - 1), spread over the threads, and returns
+  // once all of them are done.
+  void run(int tasks, const std::function<void(int)> &task);
+};
@@ -0,0 +1,15 @@
+#include "tilecache.h"
+
+#include "simd.h"
+
+TileCache::TileCache(const uint8_t *vram) : vram(vram) { invalidateAll(); }
+
+void TileCache::invalidateAll() {
+  for (uint64_t &bits : dirty)
+    bits = ~0ull;
+}
+
+void TileCache::decode(uint16_t tile) {
+  simd::decodeTileRows(vram + 16 * tile, 8, tiles[tile][0], tiles[tile][1]);
+  dirty[tile / 64] &= ~(1ull << (tile % 64));
+}
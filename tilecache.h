@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdint>
+
+constexpr int TILE_COUNT = 384;
+
+// All tiles in VRAM decoded to one color index (0-3) per byte, both as
+// stored and mirrored horizontally for sprites with the X flip attribute.
+//
+// Writes to tile data mark the tile dirty, it is decoded again the next time
+// one of its rows is requested.
+class TileCache {
+  const uint8_t *vram;
+
+  uint8_t tiles[TILE_COUNT][2][64];
+  uint64_t dirty[TILE_COUNT / 64];
+
+  void decode(uint16_t tile);
+
+public:
+  TileCache(const uint8_t *vram);
+
+  // Takes an offset into VRAM, writes outside of the tile data are ignored.
+  void invalidate(uint16_t offset) {
+    if (offset < TILE_COUNT * 16)
+      dirty[offset / (16 * 64)] |= 1ull << ((offset / 16) % 64);
+  }
+  void invalidateAll();
+
+  const uint8_t *row(uint16_t tile, uint8_t y, bool flipX) {
+    if (dirty[tile / 64] & (1ull << (tile % 64)))
+      decode(tile);
+    return &tiles[tile][flipX][8 * y];
+  }
+
+  // Index of a tile as referenced from the tile maps.
+  static uint16_t index(uint8_t tile, bool signedTileIndex) {
+    return signedTileIndex ? 256 + (int8_t)tile : tile;
+  }
+};
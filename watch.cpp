@@ -0,0 +1,127 @@
+#include "watch.h"
+
+#include <cstdio>
+#include <string>
+
+constexpr uint64_t printedHits = 16;
+
+int Watchpoints::bitmapIndex(WatchKind kind) {
+  switch (kind) {
+  case WatchRead:
+    return 0;
+  case WatchWrite:
+    return 1;
+  default:
+    return 2;
+  }
+}
+
+void Watchpoints::rebuild() {
+  for (auto &page : pageFlags)
+    page = 0;
+  for (auto &kind : bitmap)
+    for (auto &word : kind)
+      word = 0;
+
+  for (const Watchpoint &watchpoint : watchpoints) {
+    pageFlags[watchpoint.addr >> 8] |= watchpoint.kinds;
+    for (WatchKind kind : {WatchRead, WatchWrite, WatchExecute})
+      if (watchpoint.kinds & kind)
+        bitmap[bitmapIndex(kind)][watchpoint.addr / 64] |=
+            1ull << (watchpoint.addr % 64);
+  }
+}
+
+void Watchpoints::add(uint16_t addr, uint8_t kinds, bool breaks) {
+  for (Watchpoint &watchpoint : watchpoints) {
+    if (watchpoint.addr == addr) {
+      watchpoint.kinds |= kinds;
+      watchpoint.breaks = watchpoint.breaks || breaks;
+      rebuild();
+      return;
+    }
+  }
+  watchpoints.push_back({addr, kinds, breaks, 0});
+  rebuild();
+}
+
+void Watchpoints::remove(uint16_t addr) {
+  for (auto it = watchpoints.begin(); it != watchpoints.end(); it++) {
+    if (it->addr == addr) {
+      watchpoints.erase(it);
+      break;
+    }
+  }
+  rebuild();
+}
+
+void Watchpoints::clear() {
+  watchpoints.clear();
+  rebuild();
+}
+
+bool Watchpoints::addFromSpec(const std::string &spec) {
+  size_t colon = spec.find(':');
+  if (colon == std::string::npos)
+    return false;
+
+  uint8_t kinds = 0;
+  for (size_t i = 0; i < colon; i++) {
+    if (spec[i] == 'r')
+      kinds |= WatchRead;
+    else if (spec[i] == 'w')
+      kinds |= WatchWrite;
+    else if (spec[i] == 'x')
+      kinds |= WatchExecute;
+    else
+      return false;
+  }
+
+  std::string rest = spec.substr(colon + 1);
+  bool breaks = false;
+  size_t breakColon = rest.find(':');
+  if (breakColon != std::string::npos) {
+    if (rest.substr(breakColon + 1) != "break")
+      return false;
+    breaks = true;
+    rest = rest.substr(0, breakColon);
+  }
+
+  size_t parsed = 0;
+  unsigned long addr;
+  try {
+    addr = std::stoul(rest, &parsed, 16);
+  } catch (...) {
+    return false;
+  }
+  if (parsed != rest.size() || addr > 0xFFFF || kinds == 0)
+    return false;
+
+  add(addr, kinds, breaks);
+  return true;
+}
+
+bool Watchpoints::check(uint16_t addr, WatchKind kind, uint8_t value,
+                        uint16_t pc) {
+  if (!(bitmap[bitmapIndex(kind)][addr / 64] & (1ull << (addr % 64))))
+    return false;
+
+  for (Watchpoint &watchpoint : watchpoints) {
+    if (watchpoint.addr != addr)
+      continue;
+    watchpoint.hits++;
+    if (watchpoint.hits > printedHits && !watchpoint.breaks)
+      return false;
+
+    const char *action = kind == WatchRead    ? "Read"
+                         : kind == WatchWrite ? "Wrote"
+                                              : "Executed";
+    fprintf(stderr, "Watchpoint: %s %02X at %04X (PC: %04X)\n", action, value,
+            addr, pc);
+    if (watchpoint.hits == printedHits && !watchpoint.breaks)
+      fprintf(stderr, "Watchpoint: Further hits at %04X are only counted\n",
+              addr);
+    return watchpoint.breaks;
+  }
+  return false;
+}
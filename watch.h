@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+enum WatchKind : uint8_t {
+  WatchRead = 1 << 0,
+  WatchWrite = 1 << 1,
+  WatchExecute = 1 << 2,
+};
+
+// Read, write and execute watchpoints.
+//
+// Lookups are split in two levels: a byte of flags per 256 byte page, which
+// is all the fast paths ever look at, and a bitmap per kind with one bit per
+// address which is only consulted once a page is known to be watched.
+class Watchpoints {
+public:
+  struct Watchpoint {
+    uint16_t addr;
+    uint8_t kinds;
+    bool breaks;
+    uint64_t hits;
+  };
+
+private:
+  uint8_t pageFlags[0x100] = {};
+  uint64_t bitmap[3][0x10000 / 64] = {};
+
+  std::vector<Watchpoint> watchpoints;
+
+  static int bitmapIndex(WatchKind kind);
+  void rebuild();
+
+public:
+  void add(uint16_t addr, uint8_t kinds, bool breaks);
+  void remove(uint16_t addr);
+  void clear();
+
+  // Parses "<r|w|x...>:<hex address>[:break]", e.g. "rw:C0A0" or
+  // "x:0150:break".
+  bool addFromSpec(const std::string &spec);
+
+  bool isTrapped(uint8_t page, WatchKind kind) const {
+    return pageFlags[page] & kind;
+  }
+  bool isTrapped(uint8_t page) const { return pageFlags[page]; }
+
+  // Records a hit if addr is watched for kind. The first few hits of each
+  // watchpoint are printed, later ones are only counted. Returns true when
+  // the watchpoint asks for emulation to break.
+  bool check(uint16_t addr, WatchKind kind, uint8_t value, uint16_t pc);
+
+  const std::vector<Watchpoint> &list() const { return watchpoints; }
+};